@@ -0,0 +1,157 @@
+#ifndef __SERVER_CALLABLE_HPP__
+#define __SERVER_CALLABLE_HPP__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Server {
+
+// move-only replacement of std::function<void()> for tasks and coroutines,
+// functors up to INLINE_SIZE bytes are stored in place without allocation
+class Callable {
+public:
+    // inline storage, the whole object is one cache line on 64-bit targets
+    static const size_t INLINE_SIZE = 56;
+
+    Callable() noexcept {}
+
+    Callable(std::nullptr_t) noexcept {}
+
+    template<typename F, typename D = std::decay_t<F>,
+            typename = std::enable_if_t<!std::is_same_v<D, Callable>
+                                    && std::is_invocable_r_v<void, D&>>>
+    Callable(F&& f) {
+        if (isNull(f)) {
+            return;
+        }
+
+        if constexpr (storedInline<D>()) {
+            new (m_storage) D(std::forward<F>(f));
+        } else {
+            *reinterpret_cast<D**>(m_storage) = new D(std::forward<F>(f));
+        }
+        m_ops = &s_ops<D>;
+    }
+
+    Callable(Callable&& other) noexcept {
+        moveFrom(other);
+    }
+
+    Callable& operator=(Callable&& other) noexcept {
+        if (this != &other) {
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Callable& operator=(std::nullptr_t) noexcept {
+        clear();
+        return *this;
+    }
+
+    Callable(const Callable&) = delete;
+    Callable& operator=(const Callable&) = delete;
+
+    ~Callable() { clear(); }
+
+    void operator()() { m_ops->invoke(m_storage); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void swap(Callable& other) noexcept {
+        Callable tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // move functor from src storage into dst storage and destroy src
+        void (*relocate)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template<typename D>
+    static constexpr bool storedInline() {
+        return sizeof(D) <= INLINE_SIZE
+            && alignof(D) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<D>;
+    }
+
+    template<typename D>
+    static D* target(void* storage) {
+        if constexpr (storedInline<D>()) {
+            return std::launder(reinterpret_cast<D*>(storage));
+        } else {
+            return *reinterpret_cast<D**>(storage);
+        }
+    }
+
+    template<typename D>
+    static void invoke(void* storage) {
+        (*target<D>(storage))();
+    }
+
+    template<typename D>
+    static void relocate(void* dst, void* src) noexcept {
+        if constexpr (storedInline<D>()) {
+            D* f = target<D>(src);
+            new (dst) D(std::move(*f));
+            f->~D();
+        } else {
+            *reinterpret_cast<D**>(dst) = target<D>(src);
+        }
+    }
+
+    template<typename D>
+    static void destroy(void* storage) noexcept {
+        if constexpr (storedInline<D>()) {
+            target<D>(storage)->~D();
+        } else {
+            delete target<D>(storage);
+        }
+    }
+
+    template<typename D>
+    static constexpr Ops s_ops = { &invoke<D>, &relocate<D>, &destroy<D> };
+
+    // null function pointers and empty std::function make an empty Callable
+    template<typename T>
+    static bool isNull(const T& f) {
+        if constexpr (std::is_pointer_v<T> || std::is_member_pointer_v<T>) {
+            return f == nullptr;
+        } else if constexpr (std::is_same_v<T, std::function<void()>>) {
+            return !f;
+        } else {
+            return false;
+        }
+    }
+
+    void moveFrom(Callable& other) noexcept {
+        if (other.m_ops) {
+            other.m_ops->relocate(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    void clear() noexcept {
+        if (m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const Ops* m_ops = nullptr;
+};
+
+}
+
+#endif
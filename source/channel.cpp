@@ -0,0 +1,114 @@
+#include "channel.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+namespace Server {
+
+void ChannelBase::close() {
+    Waiter* woken = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+
+        // chain the waiters through next, they are unlinked from the queues
+        while (Waiter* w = m_receivers.popClaimed()) {
+            w->ok = false;
+            w->next = woken;
+            woken = w;
+        }
+
+        while (Waiter* w = m_senders.popClaimed()) {
+            w->ok = false;
+            w->next = woken;
+            woken = w;
+        }
+    }
+
+    FiberWaitQueue::wakeAll(woken);
+}
+
+bool ChannelBase::isClosed() {
+    Spinlock::Lock lock(m_mutex);
+    return m_closed;
+}
+
+// start position of the next select in this thread, spreads ready cases
+static thread_local uint32_t t_selectStart = 0;
+
+SelectResult select(SelectCase* cases, size_t count, bool block) {
+    SERVER_ASSERT(count > 0 && count <= SELECT_MAX);
+
+    // lock every channel once, in address order so selects never deadlock
+    ChannelBase* channels[SELECT_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        channels[i] = cases[i].channel;
+    }
+    std::sort(channels, channels + count);
+    size_t locked = std::unique(channels, channels + count) - channels;
+
+    auto lockAll = [&]() {
+        for (size_t i = 0; i < locked; ++i) {
+            channels[i]->m_mutex.lock();
+        }
+    };
+
+    auto unlockAll = [&]() {
+        for (size_t i = locked; i > 0; --i) {
+            channels[i - 1]->m_mutex.unlock();
+        }
+    };
+
+    lockAll();
+    size_t start = t_selectStart++ % count;
+    for (size_t n = 0; n < count; ++n) {
+        size_t i = (start + n) % count;
+        ChannelBase::Waiter* woken = nullptr;
+        ChannelBase::OpStatus status = cases[i].attempt(cases[i].channel, cases[i].data, woken);
+        if (status != ChannelBase::OpStatus::BLOCKED) {
+            unlockAll();
+            if (woken) {
+                woken->wake();
+            }
+            return SelectResult{ static_cast<int>(i), status == ChannelBase::OpStatus::DONE };
+        }
+    }
+
+    if (!block) {
+        unlockAll();
+        return SelectResult{};
+    }
+
+    // queue on every channel, the first one to claim the token wakes us
+    std::atomic<int> selected{ -1 };
+    Semaphore sem;
+    ChannelBase::Waiter waiters[SELECT_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        ChannelBase::Waiter& w = waiters[i];
+        w.prepare(&sem);
+        w.data = cases[i].data;
+        w.selected = &selected;
+        w.index = i;
+
+        ChannelBase* channel = cases[i].channel;
+        (cases[i].send ? channel->m_senders : channel->m_receivers).push(&w);
+    }
+    unlockAll();
+    waiters[0].sleep();
+
+    // drop the waiters of the cases that did not fire
+    lockAll();
+    for (size_t i = 0; i < count; ++i) {
+        ChannelBase* channel = cases[i].channel;
+        (cases[i].send ? channel->m_senders : channel->m_receivers).remove(&waiters[i]);
+    }
+    unlockAll();
+
+    int index = selected.load();
+    return SelectResult{ index, waiters[index].ok };
+}
+
+}
@@ -0,0 +1,287 @@
+#ifndef __SERVER_CHANNEL_HPP__
+#define __SERVER_CHANNEL_HPP__
+
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "fiber_sync.hpp"
+#include "macro.hpp"
+
+namespace Server {
+
+struct SelectCase;
+struct SelectResult;
+
+// wait until one of the cases can proceed and perform it, cases that are
+// ready at once are tried starting from a rotating position
+SelectResult select(SelectCase* cases, size_t count, bool block);
+
+// type independent part of Channel, shared with select()
+class ChannelBase {
+public:
+    using Waiter = FiberWaitQueue::Waiter;
+
+    // result of a non-blocking attempt
+    enum class OpStatus {
+        DONE,       // value transferred
+        BLOCKED,    // channel full (send) or empty (recv)
+        CLOSED      // channel closed (and drained for recv)
+    };
+
+    ChannelBase() = default;
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator=(const ChannelBase&) = delete;
+
+    virtual ~ChannelBase() {}
+
+    // wake every waiter, pending send fails, recv drains buffered values
+    // and then fails
+    void close();
+
+    bool isClosed();
+
+protected:
+    friend SelectResult select(SelectCase* cases, size_t count, bool block);
+
+    Spinlock m_mutex;
+    bool m_closed = false;
+
+    // coroutines blocked on a full or empty channel
+    FiberWaitQueue m_senders;
+    FiberWaitQueue m_receivers;
+};
+
+// one arm of select(), made by Channel::sendCase/recvCase
+struct SelectCase {
+    ChannelBase* channel;
+    bool send;
+
+    // value to send or slot receiving the value
+    void* data;
+
+    // try the operation with the channel locked
+    ChannelBase::OpStatus (*attempt)(ChannelBase* channel, void* data, ChannelBase::Waiter*& woken);
+};
+
+struct SelectResult {
+    // case that fired, -1 if none was ready for a non-blocking select
+    int index = -1;
+
+    // false if that channel is closed
+    bool ok = false;
+};
+
+// most cases a single select can take
+static const size_t SELECT_MAX = 16;
+
+// block on the cases, e.g. select(a.recvCase(x), b.sendCase(y))
+template<typename... Cases>
+SelectResult select(Cases... cases) {
+    SelectCase arr[] = { cases... };
+    return select(arr, sizeof...(Cases), true);
+}
+
+// perform one ready case or return index -1 without waiting
+template<typename... Cases>
+SelectResult trySelect(Cases... cases) {
+    SelectCase arr[] = { cases... };
+    return select(arr, sizeof...(Cases), false);
+}
+
+// bounded multi-producer multi-consumer channel between coroutines (or
+// threads), values live in a ring buffer allocated once. a full send or
+// empty recv parks the caller like FiberMutex, a waiting peer gets the
+// value handed over directly. capacity 0 makes every send a rendezvous
+template<typename T>
+class Channel : public ChannelBase {
+public:
+    using ptr = std::shared_ptr<Channel>;
+
+    explicit Channel(size_t capacity = 0)
+        : m_capacity{ capacity },
+        m_buffer{ capacity ? std::allocator<T>().allocate(capacity) : nullptr } {
+    }
+
+    ~Channel() {
+        while (m_size) {
+            m_buffer[m_head].~T();
+            m_head = next(m_head);
+            --m_size;
+        }
+
+        if (m_buffer) {
+            std::allocator<T>().deallocate(m_buffer, m_capacity);
+        }
+    }
+
+    // block until value is taken, false if the channel is closed
+    bool send(T value) {
+        Waiter* woken = nullptr;
+        Spinlock::Lock lock(m_mutex);
+        OpStatus status = sendLocked(std::move(value), woken);
+        if (status != OpStatus::BLOCKED) {
+            lock.unlock();
+            wakeOne(woken);
+            return status == OpStatus::DONE;
+        }
+
+        Semaphore sem;
+        Waiter w;
+        w.prepare(&sem);
+        w.data = &value;
+        m_senders.push(&w);
+        lock.unlock();
+        w.sleep();
+        return w.ok;
+    }
+
+    // block until a value arrives, false once the channel is closed and empty
+    bool recv(T& value) {
+        Waiter* woken = nullptr;
+        Spinlock::Lock lock(m_mutex);
+        OpStatus status = recvLocked(value, woken);
+        if (status != OpStatus::BLOCKED) {
+            lock.unlock();
+            wakeOne(woken);
+            return status == OpStatus::DONE;
+        }
+
+        Semaphore sem;
+        Waiter w;
+        w.prepare(&sem);
+        w.data = &value;
+        m_receivers.push(&w);
+        lock.unlock();
+        w.sleep();
+        return w.ok;
+    }
+
+    // send without waiting, value is only consumed if true is returned
+    template<typename U>
+    bool trySend(U&& value) {
+        Waiter* woken = nullptr;
+        Spinlock::Lock lock(m_mutex);
+        OpStatus status = sendLocked(std::forward<U>(value), woken);
+        lock.unlock();
+        wakeOne(woken);
+        return status == OpStatus::DONE;
+    }
+
+    // receive without waiting
+    bool tryRecv(T& value) {
+        Waiter* woken = nullptr;
+        Spinlock::Lock lock(m_mutex);
+        OpStatus status = recvLocked(value, woken);
+        lock.unlock();
+        wakeOne(woken);
+        return status == OpStatus::DONE;
+    }
+
+    // number of buffered values
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_size;
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    // select arm sending value, which is moved from when the arm fires
+    SelectCase sendCase(T& value) {
+        return SelectCase{ this, true, &value, &Channel::sendAttempt };
+    }
+
+    // select arm receiving into value
+    SelectCase recvCase(T& value) {
+        return SelectCase{ this, false, &value, &Channel::recvAttempt };
+    }
+
+private:
+    size_t next(size_t i) const { return i + 1 == m_capacity ? 0 : i + 1; }
+
+    static void wakeOne(Waiter* w) {
+        if (w) {
+            w->wake();
+        }
+    }
+
+    // value is only moved from when DONE is returned
+    template<typename U>
+    OpStatus sendLocked(U&& value, Waiter*& woken) {
+        if (m_closed) {
+            return OpStatus::CLOSED;
+        }
+
+        // receivers only wait on an empty buffer, hand the value over
+        if (Waiter* r = m_receivers.popClaimed()) {
+            *static_cast<T*>(r->data) = std::forward<U>(value);
+            r->ok = true;
+            woken = r;
+            return OpStatus::DONE;
+        }
+
+        if (m_size < m_capacity) {
+            size_t tail = m_head + m_size;
+            if (tail >= m_capacity) {
+                tail -= m_capacity;
+            }
+            new (&m_buffer[tail]) T(std::forward<U>(value));
+            ++m_size;
+            return OpStatus::DONE;
+        }
+
+        return OpStatus::BLOCKED;
+    }
+
+    OpStatus recvLocked(T& value, Waiter*& woken) {
+        if (m_size) {
+            value = std::move(m_buffer[m_head]);
+            m_buffer[m_head].~T();
+            m_head = next(m_head);
+            --m_size;
+
+            // a slot is free, move the first blocked sender into it
+            if (Waiter* s = m_senders.popClaimed()) {
+                size_t tail = m_head + m_size;
+                if (tail >= m_capacity) {
+                    tail -= m_capacity;
+                }
+                new (&m_buffer[tail]) T(std::move(*static_cast<T*>(s->data)));
+                ++m_size;
+                s->ok = true;
+                woken = s;
+            }
+            return OpStatus::DONE;
+        }
+
+        // unbuffered channel, take the value straight from a sender
+        if (Waiter* s = m_senders.popClaimed()) {
+            value = std::move(*static_cast<T*>(s->data));
+            s->ok = true;
+            woken = s;
+            return OpStatus::DONE;
+        }
+
+        return m_closed ? OpStatus::CLOSED : OpStatus::BLOCKED;
+    }
+
+    static OpStatus sendAttempt(ChannelBase* channel, void* data, Waiter*& woken) {
+        return static_cast<Channel*>(channel)->sendLocked(std::move(*static_cast<T*>(data)), woken);
+    }
+
+    static OpStatus recvAttempt(ChannelBase* channel, void* data, Waiter*& woken) {
+        return static_cast<Channel*>(channel)->recvLocked(*static_cast<T*>(data), woken);
+    }
+
+private:
+    size_t m_capacity;
+
+    // ring buffer, m_size values starting at m_head
+    T* m_buffer;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
+
+}
+
+#endif
@@ -60,6 +60,28 @@ public:
     };
 };
 
+// specialized template for conversion from string to bool, accept yaml
+// booleans (true/false, yes/no, on/off) as well as 1/0
+template<>
+class LexicalCast<std::string, bool> {
+public:
+    bool operator() (const std::string& v) {
+        if (v == "1" || v == "0") {
+            return v == "1";
+        }
+        return YAML::Load(v).as<bool>();
+    };
+};
+
+// specialized template for conversion from bool to yaml boolean string
+template<>
+class LexicalCast<bool, std::string> {
+public:
+    std::string operator() (const bool& v) {
+        return v ? "true" : "false";
+    };
+};
+
 // partial specialized template for conversion from string to vector
 template<typename T>
 class LexicalCast<std::string, std::vector<T>> {
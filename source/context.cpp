@@ -0,0 +1,153 @@
+#include "context.hpp"
+
+#include <stdint.h>
+
+#if SERVER_HAS_FCONTEXT
+
+extern "C" {
+
+// first frame of a new context, calls the entry stored in a callee-saved register
+void server_fcontext_entry();
+
+}
+
+#if defined(__x86_64__)
+
+// saved frame (from low to high address):
+// mxcsr | x87 cw | r12 | r13 | r14 | r15 | rbx | rbp | return address
+asm(R"(
+    .text
+    .globl server_jump_fcontext
+    .type server_jump_fcontext, @function
+    .p2align 4
+server_jump_fcontext:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    leaq -8(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    leaq 8(%rsp), %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size server_jump_fcontext, .-server_jump_fcontext
+
+    .globl server_fcontext_entry
+    .type server_fcontext_entry, @function
+    .p2align 4
+server_fcontext_entry:
+    .cfi_startproc
+    .cfi_undefined rip
+    call *%r12
+    ud2
+    .cfi_endproc
+    .size server_fcontext_entry, .-server_fcontext_entry
+)");
+
+namespace Server {
+
+void* makeFContext(void* stack, size_t size, void (*fn)()) {
+    // stack pointer is 16-byte aligned once the frame is popped,
+    // so the entry is called with the alignment required by the ABI
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+    top -= 16;
+
+    void** sp = reinterpret_cast<void**>(top - 8 * sizeof(void*));
+    uint32_t* fpu = reinterpret_cast<uint32_t*>(sp);
+    fpu[0] = 0x1F80;    // default mxcsr
+    fpu[1] = 0x037F;    // default x87 control word
+
+    sp[1] = reinterpret_cast<void*>(fn);     // r12
+    for (int i = 2; i < 7; ++i) {
+        sp[i] = nullptr;
+    }
+    sp[7] = reinterpret_cast<void*>(&server_fcontext_entry);
+
+    return sp;
+}
+
+}
+
+#elif defined(__aarch64__)
+
+// saved frame (from low to high address):
+// d8 - d15 | x19 - x28 | x29 (fp) | x30 (lr)
+asm(R"(
+    .text
+    .globl server_jump_fcontext
+    .type server_jump_fcontext, %function
+    .p2align 4
+server_jump_fcontext:
+    sub sp, sp, #160
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size server_jump_fcontext, .-server_jump_fcontext
+
+    .globl server_fcontext_entry
+    .type server_fcontext_entry, %function
+    .p2align 4
+server_fcontext_entry:
+    .cfi_startproc
+    .cfi_undefined x30
+    blr x19
+    brk #0
+    .cfi_endproc
+    .size server_fcontext_entry, .-server_fcontext_entry
+)");
+
+namespace Server {
+
+void* makeFContext(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+    top -= 16;
+
+    void** sp = reinterpret_cast<void**>(top - 20 * sizeof(void*));
+    for (int i = 0; i < 20; ++i) {
+        sp[i] = nullptr;
+    }
+    sp[8] = reinterpret_cast<void*>(fn);                        // x19
+    sp[19] = reinterpret_cast<void*>(&server_fcontext_entry);   // x30
+
+    return sp;
+}
+
+}
+
+#endif
+
+#endif
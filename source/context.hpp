@@ -0,0 +1,41 @@
+#ifndef __SERVER_CONTEXT_HPP__
+#define __SERVER_CONTEXT_HPP__
+
+#include <stddef.h>
+
+// hand-written context switch is only implemented for x86-64 and aarch64
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SERVER_HAS_FCONTEXT 1
+#else
+#define SERVER_HAS_FCONTEXT 0
+#endif
+
+// SERVER_FIBER_ASM_CONTEXT is set by cmake option FIBER_ASM_CONTEXT,
+// coroutines fall back to ucontext_t when it is off or unsupported
+#if defined(SERVER_FIBER_ASM_CONTEXT) && SERVER_HAS_FCONTEXT
+#define SERVER_FIBER_USE_ASM_CONTEXT 1
+#else
+#define SERVER_FIBER_USE_ASM_CONTEXT 0
+#endif
+
+#if SERVER_HAS_FCONTEXT
+
+extern "C" {
+
+// push callee-saved registers on current stack, store the stack pointer
+// into *from, then pop registers of the context saved at stack pointer to
+void server_jump_fcontext(void** from, void* to);
+
+}
+
+namespace Server {
+
+// prepare a context on stack [stack, stack + size), jumping into the
+// returned stack pointer calls fn, which must never return
+void* makeFContext(void* stack, size_t size, void (*fn)());
+
+}
+
+#endif
+
+#endif
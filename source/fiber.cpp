@@ -5,6 +5,10 @@
 #include "scheduler.hpp"
 
 #include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace Server {
 
@@ -22,6 +26,39 @@ static thread_local Fiber::ptr t_threadFiber{ nullptr };
 static ConfigArg<uint32_t>::ptr gFiberStackSize = 
     ConfigMgr::lookUp<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
 
+static ConfigArg<std::string>::ptr gFiberStackAllocator =
+    ConfigMgr::lookUp<std::string>("fiber.stack_allocator", "mmap", "fiber stack allocator (mmap, malloc)");
+
+static ConfigArg<uint32_t>::ptr gFiberCacheMax =
+    ConfigMgr::lookUp<uint32_t>("fiber.cache_max", 64, "max coroutines and stacks cached per thread");
+
+// allocator used by new coroutines, updated when fiber.stack_allocator changes
+static std::atomic<StackAllocatorType> s_stackAllocatorType{ StackAllocatorType::MMAP };
+
+static ConfigArg<uint32_t>::ptr gFiberSharedStackCount =
+    ConfigMgr::lookUp<uint32_t>("fiber.shared_stack_count", 4, "shared stacks per thread for shared-stack fibers");
+
+// high-water limit of each thread's cache, updated when fiber.cache_max changes
+static std::atomic<uint32_t> s_fiberCacheMax{ 64 };
+
+static ConfigArg<bool>::ptr gFiberStackWatermark =
+    ConfigMgr::lookUp<bool>("fiber.stack_watermark", false, 
+                            "measure peak stack usage of fibers (commits whole stacks)");
+
+// paint new stacks and measure them, updated when fiber.stack_watermark changes
+static std::atomic<bool> s_stackWatermark{ false };
+
+// byte written over unused stack, a word still holding it was never touched
+static const int STACK_PATTERN_BYTE = 0xfd;
+static const uint64_t STACK_PATTERN = 0xfdfdfdfdfdfdfdfdULL;
+
+// peak stack usage of coroutines in the process
+static Log2Histogram s_stackUsage;
+
+// destructors of registered FiberLocal slots
+static std::atomic<size_t> s_localCount{ 0 };
+static void (*s_localDtors[Fiber::LOCAL_SLOTS])(void*) = {};
+
 class MallocStackAllocator {
 public:
     static void* Alloc(size_t size) {
@@ -33,7 +70,286 @@ public:
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+// map stack with mmap, a PROT_NONE guard page below the stack turns
+// overflow into SIGSEGV, pages are only committed when first touched.
+// each stack takes two mappings, so vm.max_map_count bounds live coroutines
+class MMapStackAllocator {
+public:
+    static void* Alloc(size_t size) {
+        size_t len = mapLength(size);
+        void* vp = mmap(nullptr, len, PROT_READ | PROT_WRITE, 
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (vp == MAP_FAILED) {
+            SERVER_LOG_ERROR(g_logger) << "mmap stack failed, size = " << len
+                                    << " (" << errno << ") (" << strerror(errno) << ")";
+            throw std::bad_alloc();
+        }
+
+        // guard page at the lowest address, stack grows downwards
+        if (mprotect(vp, pageSize(), PROT_NONE)) {
+            SERVER_LOG_ERROR(g_logger) << "mprotect guard page failed"
+                                    << " (" << errno << ") (" << strerror(errno) << ")";
+            munmap(vp, len);
+            throw std::bad_alloc();
+        }
+
+        return static_cast<char*>(vp) + pageSize();
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        munmap(static_cast<char*>(vp) - pageSize(), mapLength(size));
+    }
+
+private:
+    static size_t pageSize() {
+        static const size_t s_pageSize = sysconf(_SC_PAGESIZE);
+        return s_pageSize;
+    }
+
+    // stack rounded up to whole pages plus the guard page
+    static size_t mapLength(size_t size) {
+        size_t page = pageSize();
+        return (size + page - 1) / page * page + page;
+    }
+};
+
+class StackAllocator {
+public:
+    static void* Alloc(size_t size, StackAllocatorType type) {
+        if (type == StackAllocatorType::MMAP) {
+            return MMapStackAllocator::Alloc(size);
+        }
+        return MallocStackAllocator::Alloc(size);
+    }
+
+    static void Dealloc(void* vp, size_t size, StackAllocatorType type) {
+        if (type == StackAllocatorType::MMAP) {
+            MMapStackAllocator::Dealloc(vp, size);
+        } else {
+            MallocStackAllocator::Dealloc(vp, size);
+        }
+    }
+
+    // parse fiber.stack_allocator, unknown names fall back to mmap
+    static StackAllocatorType FromString(const std::string& name) {
+        if (name == "malloc") {
+            return StackAllocatorType::MALLOC;
+        }
+
+        if (name != "mmap") {
+            SERVER_LOG_ERROR(g_logger) << "unknown fiber.stack_allocator " << name << ", use mmap";
+        }
+        return StackAllocatorType::MMAP;
+    }
+};
+
+// set up stack allocator before main()
+struct FiberIniter {
+    FiberIniter() {
+        s_stackAllocatorType = StackAllocator::FromString(gFiberStackAllocator->getValue());
+        gFiberStackAllocator->addListener([](const std::string& oldValue, 
+                                            const std::string& newValue) {
+            s_stackAllocatorType = StackAllocator::FromString(newValue);
+        });
+
+        s_fiberCacheMax = gFiberCacheMax->getValue();
+        gFiberCacheMax->addListener([](const uint32_t& oldValue, const uint32_t& newValue) {
+            s_fiberCacheMax = newValue;
+        });
+
+        s_stackWatermark = gFiberStackWatermark->getValue();
+        gFiberStackWatermark->addListener([](const bool& oldValue, const bool& newValue) {
+            s_stackWatermark = newValue;
+        });
+    }
+};
+
+static FiberIniter __fiber_init;
+
+// stack that shared-stack coroutines of a thread take turns to run on
+struct SharedStack {
+    void* stack = nullptr;
+    size_t size = 0;
+    StackAllocatorType type = StackAllocatorType::MMAP;
+
+    // id of coroutine whose frames are currently on the stack
+    uint64_t owner = 0;
+
+    char* top() const { return static_cast<char*>(stack) + size; }
+};
+
+// per-thread free lists of terminated coroutines and their stacks, stacks
+// are grouped by power-of-two size classes so they can be handed to any
+// coroutine requesting a size in the same class
+class FiberCache {
+public:
+    // smallest size class is 16KiB, largest is 16MiB, bigger stacks are not cached
+    static const size_t MIN_CLASS_SHIFT = 14;
+    static const size_t CLASS_COUNT = 11;
+
+    ~FiberCache() {
+        m_closed = true;
+        for (auto& fibers : m_fibers) {
+            for (auto f : fibers) {
+                delete f;
+            }
+        }
+
+        for (auto& stacks : m_stacks) {
+            for (auto& i : stacks) {
+                StackAllocator::Dealloc(i.ptr, i.size, i.type);
+            }
+        }
+
+        for (auto& i : m_sharedStacks) {
+            StackAllocator::Dealloc(i.stack, i.size, i.type);
+        }
+    }
+
+    // shared stack of this thread for coroutine id, stacks are created on first use
+    SharedStack* getSharedStack(uint64_t id) {
+        if (m_sharedStacks.empty()) {
+            m_sharedStacks.resize(std::max<uint32_t>(gFiberSharedStackCount->getValue(), 1));
+            for (auto& i : m_sharedStacks) {
+                i.size = gFiberStackSize->getValue();
+                i.type = s_stackAllocatorType;
+                i.stack = StackAllocator::Alloc(i.size, i.type);
+            }
+        }
+
+        return &m_sharedStacks[id % m_sharedStacks.size()];
+    }
+
+    // cache of current thread, nullptr once the thread is exiting
+    static FiberCache* getThis();
+
+    // size class of a stack, -1 if it is too big to be cached
+    static int sizeClass(size_t size) {
+        size_t classSize = static_cast<size_t>(1) << MIN_CLASS_SHIFT;
+        for (size_t i = 0; i < CLASS_COUNT; ++i, classSize <<= 1) {
+            if (size <= classSize) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // stack size rounded up to its size class
+    static size_t roundSize(size_t size) {
+        int cls = sizeClass(size);
+        return cls < 0 ? size : static_cast<size_t>(1) << (MIN_CLASS_SHIFT + cls);
+    }
+
+    // take a stack from cache of current thread or from the allocator
+    static void* AllocStack(size_t size, StackAllocatorType& type) {
+        FiberCache* cache = getThis();
+        int cls = sizeClass(size);
+        if (cache && cls >= 0 && !cache->m_stacks[cls].empty()) {
+            Stack stack = cache->m_stacks[cls].back();
+            cache->m_stacks[cls].pop_back();
+            --cache->m_count;
+            type = stack.type;
+            return stack.ptr;
+        }
+
+        type = s_stackAllocatorType;
+        return StackAllocator::Alloc(size, type);
+    }
+
+    // keep stack in cache of current thread if there is room, otherwise free it
+    static void DeallocStack(void* vp, size_t size, StackAllocatorType type) {
+        FiberCache* cache = getThis();
+        int cls = sizeClass(size);
+        if (cache && cls >= 0 && !cache->m_closed && cache->hasRoom()) {
+            cache->m_stacks[cls].push_back(Stack{ vp, size, type });
+            ++cache->m_count;
+            return;
+        }
+
+        StackAllocator::Dealloc(vp, size, type);
+    }
+
+    // terminated coroutine whose stack is in the size class of size
+    Fiber* popFiber(size_t size) {
+        int cls = sizeClass(size);
+        if (cls < 0 || m_fibers[cls].empty()) {
+            return nullptr;
+        }
+
+        Fiber* f = m_fibers[cls].back();
+        m_fibers[cls].pop_back();
+        --m_count;
+        return f;
+    }
+
+    bool pushFiber(Fiber* f) {
+        int cls = sizeClass(f->m_stackSize);
+        if (cls < 0 || m_closed || !hasRoom()) {
+            return false;
+        }
+
+        m_fibers[cls].push_back(f);
+        ++m_count;
+        return true;
+    }
+
+    bool hasRoom() const { return m_count < s_fiberCacheMax; }
+
+private:
+    struct Stack {
+        void* ptr;
+        size_t size;
+        StackAllocatorType type;
+    };
+
+    // cached coroutines and stacks of each size class
+    std::vector<Fiber*> m_fibers[CLASS_COUNT];
+    std::vector<Stack> m_stacks[CLASS_COUNT];
+
+    // stacks shared by shared-stack coroutines of this thread
+    std::vector<SharedStack> m_sharedStacks;
+
+    // total number of cached coroutines and stacks
+    size_t m_count = 0;
+
+    // set while the cache is destroyed, coroutines deleted then free their stacks
+    bool m_closed = false;
+};
+
+// cache is created on first use, destroyed when the thread exits
+static thread_local FiberCache* t_fiberCache{ nullptr };
+static thread_local bool t_fiberCacheExited{ false };
+
+// unfinished shared-stack coroutines whose frames live on stacks of this thread
+static thread_local uint64_t t_boundFibers{ 0 };
+
+// raised when the running coroutine should give up the thread, see maybeYield()
+static thread_local std::atomic<bool>* t_preemptFlag{ nullptr };
+
+struct FiberCacheHolder {
+    ~FiberCacheHolder() {
+        FiberCache* cache = t_fiberCache;
+        t_fiberCacheExited = true;
+        t_fiberCache = nullptr;
+        delete cache;
+    }
+};
+
+FiberCache* FiberCache::getThis() {
+    if (!t_fiberCache && !t_fiberCacheExited) {
+        static thread_local FiberCacheHolder holder;
+        t_fiberCache = new FiberCache;
+    }
+    return t_fiberCache;
+}
+
+uint64_t Fiber::boundFibers() {
+    return t_boundFibers;
+}
+
+bool Fiber::onSharedStack() {
+    return t_fiber && t_fiber->m_stackMode == StackMode::SHARED;
+}
 
 uint64_t Fiber::getFiberId() {
     if (t_fiber) {
@@ -47,40 +363,44 @@ Fiber::Fiber() {
     m_state = State::EXEC;
     setThis(this);
 
+#if !SERVER_FIBER_USE_ASM_CONTEXT
     if (getcontext(&m_ctx)) {
         SERVER_ASSERT_INFO(false, "getcontext failed");
     }
+#endif
 
     ++s_fiber_count;
     SERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stackSize, bool useCaller)
-    : m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(Callable cb, size_t stackSize, bool useCaller, StackMode mode)
+    : m_id(++s_fiber_id), m_cb(std::move(cb)) {
 
     ++s_fiber_count;
-    m_stackSize = stackSize ? stackSize : gFiberStackSize->getValue();
-
-    m_stack = StackAllocator::Alloc(m_stackSize);
-    // get current state of thread
-    if (getcontext(&m_ctx)) {
-        SERVER_ASSERT_INFO(false, "getcontext failed");
+    if (mode == StackMode::SHARED) {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+        SERVER_ASSERT_INFO(!useCaller, "caller coroutine cannot use shared stack");
+        // context is built on the shared stack when the coroutine first runs
+        m_stackMode = StackMode::SHARED;
+        SERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id << " shared stack";
+        return;
+#else
+        SERVER_LOG_WARN(g_logger) << "shared stack requires assembly context switch, "
+                                << "fiber id = " << m_id << " uses private stack";
+#endif
     }
-    // points to the context that will be resumed when the current context terminates
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stackSize;
 
-    if (useCaller) {
-        makecontext(&m_ctx, &Fiber::callerMainFunc, 0);
-    } else {
-        makecontext(&m_ctx, &Fiber::mainFunc, 0);
-    }
+    m_stackSize = FiberCache::roundSize(stackSize ? stackSize : gFiberStackSize->getValue());
+    m_stack = FiberCache::AllocStack(m_stackSize, m_stackAllocator);
+    paintStack();
+    makeContext(useCaller ? &Fiber::callerMainFunc : &Fiber::mainFunc);
+
     SERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
+    destroyLocals();
     
     if (m_stack) {
         // sub coroutine
@@ -88,7 +408,15 @@ Fiber::~Fiber() {
                     || m_state == State::EXCEPT
                     || m_state == State::INIT);
 
-        StackAllocator::Dealloc(m_stack, m_stackSize);
+        measureStack();
+        FiberCache::DeallocStack(m_stack, m_stackSize, m_stackAllocator);
+    } else if (m_stackMode == StackMode::SHARED) {
+        // sub coroutine on shared stack
+        SERVER_ASSERT(m_state == State::TERM 
+                    || m_state == State::EXCEPT
+                    || m_state == State::INIT);
+
+        free(m_savedStack);
     } else {
         // main coroutine
         SERVER_ASSERT(!m_cb);
@@ -103,58 +431,236 @@ Fiber::~Fiber() {
     SERVER_LOG_DEBUG(g_logger) << "Fiber::~Fiber id = " << m_id;
 }
 
-void Fiber::reset(std::function<void()> cb) {
-    SERVER_ASSERT(m_stack);
+Fiber::ptr Fiber::create(Callable cb, size_t stackSize) {
+    size_t size = stackSize ? stackSize : gFiberStackSize->getValue();
+    FiberCache* cache = FiberCache::getThis();
+    Fiber* f = cache ? cache->popFiber(size) : nullptr;
+    if (f) {
+        f->m_id = ++s_fiber_id;
+        f->reset(std::move(cb));
+    } else {
+        f = new Fiber(std::move(cb), size);
+    }
+
+    return Fiber::ptr(f, &Fiber::recycle);
+}
+
+void Fiber::prewarm(size_t n, size_t stackSize) {
+    FiberCache* cache = FiberCache::getThis();
+    if (!cache) {
+        return;
+    }
+
+    size_t size = stackSize ? stackSize : gFiberStackSize->getValue();
+    for (size_t i = 0; i < n && cache->hasRoom(); ++i) {
+        Fiber* f = new Fiber(nullptr, size);
+        if (!cache->pushFiber(f)) {
+            delete f;
+            break;
+        }
+    }
+}
+
+void Fiber::recycle(Fiber* f) {
+    FiberCache* cache = FiberCache::getThis();
+    if (cache && (f->m_state == State::TERM 
+                || f->m_state == State::EXCEPT
+                || f->m_state == State::INIT)) {
+        // release resources held by the callback before parking the coroutine
+        f->m_cb = nullptr;
+        f->measureStack();
+        if (cache->pushFiber(f)) {
+            return;
+        }
+    }
+
+    delete f;
+}
+
+void Fiber::reset(Callable cb) {
+    SERVER_ASSERT(m_stack || m_stackMode == StackMode::SHARED);
     // the coroutine should not be in execution
     SERVER_ASSERT(m_state == State::TERM 
                 || m_state == State::EXCEPT
                 || m_state == State::INIT);
 
-    m_cb = cb;
-    if (getcontext(&m_ctx)){
-        SERVER_ASSERT_INFO(false, "getcontext");
+    destroyLocals();
+    m_cb = std::move(cb);
+    m_group = nullptr;
+    if (m_stackMode == StackMode::SHARED) {
+        // start over on whichever thread runs it next
+        m_savedSize = 0;
+        m_sharedStack = nullptr;
+        m_boundThread = -1;
+#if SERVER_FIBER_USE_ASM_CONTEXT
+        m_ctx = nullptr;
+#endif
+    } else {
+        measureStack();
+        paintStack();
+        makeContext(&Fiber::mainFunc);
     }
+    m_state = State::INIT;
+}
 
+void Fiber::makeContext(void (*fn)()) {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    m_ctx = makeFContext(m_stack, m_stackSize, fn);
+#else
+    // get current state of thread
+    if (getcontext(&m_ctx)) {
+        SERVER_ASSERT_INFO(false, "getcontext failed");
+    }
+    // points to the context that will be resumed when the current context terminates
     m_ctx.uc_link = nullptr;
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stackSize;
 
-    makecontext(&m_ctx, &Fiber::mainFunc, 0);
-    m_state = State::INIT;
+    makecontext(&m_ctx, fn, 0);
+#endif
+}
+
+void Fiber::switchContext(Fiber* from, Fiber* to) {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    // only callee-saved registers are switched, no signal mask syscall
+    server_jump_fcontext(&from->m_ctx, to->m_ctx);
+#else
+    if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+        SERVER_ASSERT_INFO(false, "swapcontext failed");
+    }
+#endif
+}
+
+void Fiber::loadStack() {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    if (!m_sharedStack) {
+        FiberCache* cache = FiberCache::getThis();
+        SERVER_ASSERT(cache);
+        m_sharedStack = cache->getSharedStack(m_id);
+        m_boundThread = Server::getThreadId();
+        ++t_boundFibers;
+    }
+    SERVER_ASSERT_INFO(m_boundThread == Server::getThreadId(), 
+                    "shared-stack fiber id = " + std::to_string(m_id) + " resumed on another thread");
+
+    SharedStack* shared = m_sharedStack;
+    if (!m_ctx) {
+        m_ctx = makeFContext(shared->stack, shared->size, &Fiber::mainFunc);
+    } else if (shared->owner != m_id) {
+        // frames of another coroutine occupy the stack, put ours back
+        memcpy(shared->top() - m_savedSize, m_savedStack, m_savedSize);
+    }
+    shared->owner = m_id;
+#endif
+}
+
+void Fiber::saveStack() {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    if (m_state == State::TERM || m_state == State::EXCEPT) {
+        free(m_savedStack);
+        m_savedStack = nullptr;
+        m_savedSize = m_savedCapacity = 0;
+        m_sharedStack->owner = 0;
+        --t_boundFibers;
+        return;
+    }
+
+    // live frames span from saved stack pointer to the top of shared stack,
+    // they stay on the stack as well until another coroutine takes it over
+    char* sp = static_cast<char*>(m_ctx);
+    m_savedSize = m_sharedStack->top() - sp;
+    if (m_savedCapacity < m_savedSize) {
+        char* buf = static_cast<char*>(realloc(m_savedStack, m_savedSize));
+        if (!buf) {
+            throw std::bad_alloc();
+        }
+        m_savedStack = buf;
+        m_savedCapacity = m_savedSize;
+    }
+    memcpy(m_savedStack, sp, m_savedSize);
+#endif
+}
+
+void Fiber::paintStack() {
+    if (!s_stackWatermark) {
+        m_stackClean = 0;
+        m_stackPainted = false;
+        return;
+    }
+
+    // stack grows downwards, bytes below the last high-water mark are still painted
+    memset(static_cast<char*>(m_stack) + m_stackClean, STACK_PATTERN_BYTE, m_stackSize - m_stackClean);
+    m_stackClean = m_stackSize;
+    m_stackPainted = true;
+}
+
+void Fiber::measureStack() {
+    // a coroutine that never ran only has its initial frame on the stack
+    if (!m_stackPainted || m_state == State::INIT) {
+        return;
+    }
+
+    const uint64_t* words = static_cast<const uint64_t*>(m_stack);
+    size_t count = m_stackClean / sizeof(uint64_t);
+    size_t i = 0;
+    while (i < count && words[i] == STACK_PATTERN) {
+        ++i;
+    }
+
+    m_stackClean = i * sizeof(uint64_t);
+    m_stackPainted = false;
+    s_stackUsage.add(m_stackSize - m_stackClean);
 }
 
 void Fiber::call() {
     setThis(this);
     SERVER_ASSERT(m_state != State::EXEC);
     m_state = State::EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        SERVER_ASSERT_INFO(false, "call: swapcontext failed");
-    }
+    switchContext(t_threadFiber.get(), this);
 }
 
 void Fiber::back() {
     setThis(t_threadFiber.get());
     SERVER_ASSERT(m_state != State::EXEC);
-    if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        SERVER_ASSERT_INFO(false, "back: swapcontext failed");
-    }
+    switchContext(this, t_threadFiber.get());
+}
+
+// coroutine that sub coroutines swap with, main coroutine of
+// scheduler if thread is running one, main coroutine of thread otherwise
+static Fiber* getSwapFiber() {
+    Fiber* main = Scheduler::getMainFiber();
+    return main ? main : t_threadFiber.get();
 }
 
-void Fiber::swapIn() {
+Fiber::State Fiber::swapIn() {
     setThis(this);
     SERVER_ASSERT(m_state != State::EXEC);
     m_state = State::EXEC;
+    if (m_stackMode == StackMode::SHARED) {
+        loadStack();
+    }
+
     // swap with the coroutine that is currently working on thread
-    if (swapcontext(&Scheduler::getMainFiber()->m_ctx, &m_ctx)) {
-        SERVER_ASSERT_INFO(false, "swapin: swapcontext failed");
+    switchContext(getSwapFiber(), this);
+
+    if (m_stackMode == StackMode::SHARED) {
+        saveStack();
+    }
+
+    // context is saved, publish HOLD last so a waker on another thread
+    // can only resume the coroutine from here on
+    State state = m_state;
+    if (state == State::EXEC) {
+        state = State::HOLD;
+        m_state = state;
     }
+    return state;
 }
 
 void Fiber::swapOut() {
-    setThis(Scheduler::getMainFiber());
-    if (swapcontext(&m_ctx, &Scheduler::getMainFiber()->m_ctx)) {
-        SERVER_ASSERT_INFO(false, "swapout: swapcontext failed");
-    }
+    Fiber* main = getSwapFiber();
+    setThis(main);
+    switchContext(this, main);
 }
 
 void Fiber::setThis(Fiber* f) {
@@ -184,10 +690,21 @@ void Fiber::yieldToReady() {
     cur->swapOut();
 }
 
+void Fiber::maybeYield() {
+    std::atomic<bool>* flag = t_preemptFlag;
+    if (flag && flag->load(std::memory_order_relaxed)) {
+        flag->store(false, std::memory_order_relaxed);
+        yieldToReady();
+    }
+}
+
+void Fiber::setPreemptFlag(std::atomic<bool>* flag) {
+    t_preemptFlag = flag;
+}
+
 void Fiber::yieldToHold() {
     SERVER_ASSERT(t_fiber != t_threadFiber.get());
     Fiber::ptr cur = getThis();
-    cur->m_state = State::HOLD;
     cur->swapOut();
 }
 
@@ -195,6 +712,43 @@ uint64_t Fiber::totalFibers() {
     return s_fiber_count;
 }
 
+const char* Fiber::getContextBackend() {
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    return "fcontext";
+#else
+    return "ucontext";
+#endif
+}
+
+size_t Fiber::registerLocal(void (*dtor)(void*)) {
+    size_t idx = s_localCount++;
+    SERVER_ASSERT_INFO(idx < LOCAL_SLOTS, "too many FiberLocal variables");
+    s_localDtors[idx] = dtor;
+    return idx;
+}
+
+Fiber* Fiber::current() {
+    if (!t_fiber) {
+        getThis();
+    }
+    return t_fiber;
+}
+
+void Fiber::destroyLocals() {
+    size_t count = std::min<size_t>(s_localCount, LOCAL_SLOTS);
+    for (size_t i = 0; i < count; ++i) {
+        if (m_locals[i]) {
+            void* value = m_locals[i];
+            m_locals[i] = nullptr;
+            s_localDtors[i](value);
+        }
+    }
+}
+
+Log2Histogram& Fiber::getStackUsage() {
+    return s_stackUsage;
+}
+
 void Fiber::mainFunc() {
     Fiber::ptr cur = getThis();
     SERVER_ASSERT(cur);
@@ -216,6 +770,9 @@ void Fiber::mainFunc() {
                             << Server::BacktraceToString();
     }
 
+    // free local values while still running on the coroutine
+    cur->destroyLocals();
+
     auto r_ptr = cur.get();
     cur.reset();
     r_ptr->swapOut();
@@ -244,6 +801,9 @@ void Fiber::callerMainFunc() {
                             << Server::BacktraceToString();
     }
 
+    // free local values while still running on the coroutine
+    cur->destroyLocals();
+
     auto r_ptr = cur.get();
 
     // release ownership of shared_ptr
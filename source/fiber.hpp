@@ -2,19 +2,38 @@
 #define __SERVER_FIBER_HPP__
 
 #include <ucontext.h>
+#include <atomic>
 #include <memory>
 #include <functional>
 
+#include "callable.hpp"
+#include "context.hpp"
+#include "histogram.hpp"
 #include "thread.hpp"
 
 namespace Server {
 
+// backend of coroutine stacks, selected by config fiber.stack_allocator
+enum class StackAllocatorType : uint8_t {
+    MALLOC,     // heap memory, no overflow protection
+    MMAP        // private mapping with guard page, committed on first touch
+};
+
 class Scheduler;
+class TaskGroup;
+class FiberCache;
+struct SharedStack;
+template<typename T> class FiberLocal;
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
+friend class FiberCache;
+template<typename T> friend class FiberLocal;
 public:
     using ptr = std::shared_ptr<Fiber>;
 
+    // number of FiberLocal variables a process can register
+    static const size_t LOCAL_SLOTS = 16;
+
     enum class State {
         INIT,   // initialized
         HOLD,   // suspend
@@ -24,21 +43,37 @@ public:
         EXCEPT  // exception
     };
 
+    // where a sub coroutine keeps its stack
+    enum class StackMode {
+        PRIVATE,    // own stack of fiber.stack_size
+        SHARED      // runs on a stack shared by coroutines of the thread, live
+                    // frames are copied to a heap buffer while suspended. the
+                    // addresses of its locals are only valid while it runs:
+                    // it cannot park on anything that keeps a pointer into its
+                    // stack (FiberWaitQueue, channels, offload, parallelFor)
+    };
+
 private:
     // constructor for main coroutine
     Fiber();
 
 public:
     // constructor for sub coroutine
-    Fiber(std::function<void()> cb, size_t stackSize = 0, bool useCaller = false);
+    // mode: SHARED needs the assembly context switch, a shared-stack coroutine is
+    // bound to the thread it first runs on and cannot be used as caller coroutine
+    Fiber(Callable cb, size_t stackSize = 0, bool useCaller = false, 
+        StackMode mode = StackMode::PRIVATE);
 
     ~Fiber();
     
     // reset state of a sub coroutine after it finishes
-    void reset(std::function<void()> cb);
+    void reset(Callable cb);
 
-    // suspend main thread(coroutine) and switch into sub coroutine
-    void swapIn();
+    // suspend main thread(coroutine) and switch into sub coroutine, return the
+    // state the sub coroutine switched out with (EXEC is published as HOLD).
+    // once HOLD is published another thread may resume it, so the returned
+    // value is the only state the caller can rely on
+    State swapIn();
 
     // switch back to main coroutine
     void swapOut();
@@ -53,7 +88,19 @@ public:
     // return the state of coroutine
     State getState() const { return m_state; };
 
+    StackMode getStackMode() const { return m_stackMode; };
+
+    // thread a shared-stack coroutine is bound to, -1 if it can run on any thread
+    int getBoundThread() const { return m_boundThread; };
+
 public:
+    // create a sub coroutine, reusing a terminated one cached by current thread,
+    // the coroutine goes back to the cache of the thread that releases it
+    static Fiber::ptr create(Callable cb, size_t stackSize = 0);
+
+    // cache n coroutines in current thread ahead of the first burst of tasks
+    static void prewarm(size_t n, size_t stackSize = 0);
+
     // setup current coroutine
     static void setThis(Fiber* f);
 
@@ -63,12 +110,26 @@ public:
     // switch out from sub coroutine and set sub coroutine to ready state
     static void yieldToReady();
 
-    // switch out from sub coroutine and set sub coroutine to hold state
+    // preemption point for long loops: yield like yieldToReady once the
+    // scheduler watchdog finds the current slice over its budget, otherwise
+    // it only reads a flag
+    static void maybeYield();
+
+    // switch out from sub coroutine and set sub coroutine to hold state, the
+    // coroutine stays EXEC until it is off its stack, so it is safe to hand it
+    // to Scheduler::schedule from another thread before yielding
     static void yieldToHold();
 
     // total number of coroutines
     static uint64_t totalFibers();
 
+    // unfinished shared-stack coroutines bound to current thread, the thread
+    // has to outlive them
+    static uint64_t boundFibers();
+
+    // whether current coroutine runs on a shared stack
+    static bool onSharedStack();
+
     // callback in coroutine
     static void mainFunc();
 
@@ -77,6 +138,48 @@ public:
 
     // return coroutine id
     static uint64_t getFiberId();
+
+    // name of the context switch backend ("fcontext" or "ucontext")
+    static const char* getContextBackend();
+
+    // peak stack usage in bytes of finished coroutines, recorded only while
+    // fiber.stack_watermark is on and only for coroutines with a private stack
+    static Log2Histogram& getStackUsage();
+private:
+    // deleter of coroutines from create(), keep terminated ones in thread cache
+    static void recycle(Fiber* f);
+
+    // flag a scheduler raises when the coroutine running on current thread
+    // should yield, nullptr while no preemptible slice runs
+    static void setPreemptFlag(std::atomic<bool>* flag);
+
+    // reserve a local slot whose values are freed with dtor, return slot index
+    static size_t registerLocal(void (*dtor)(void*));
+
+    // coroutine running on current thread, main coroutine is created if needed
+    static Fiber* current();
+
+    // free values of all local slots
+    void destroyLocals();
+
+    // build the initial context which runs fn on coroutine stack
+    void makeContext(void (*fn)());
+
+    // save current context into from and resume to
+    static void switchContext(Fiber* from, Fiber* to);
+
+    // put frames of a shared-stack coroutine back on its shared stack
+    void loadStack();
+
+    // copy live frames of a suspended shared-stack coroutine to heap
+    void saveStack();
+
+    // fill the stack with the watermark pattern before the coroutine starts
+    void paintStack();
+
+    // record how deep the last run of the coroutine went into its stack
+    void measureStack();
+
 private:
     // coroutine id
     uint64_t m_id = 0;
@@ -84,15 +187,50 @@ private:
     // coroutine size
     uint32_t m_stackSize = 0;
 
-    // coroutine state
-    State m_state = State::INIT;
+    // coroutine state, read by other threads to tell if the coroutine is
+    // still switching out
+    std::atomic<State> m_state{ State::INIT };
 
+#if SERVER_FIBER_USE_ASM_CONTEXT
+    // saved stack pointer of suspended coroutine
+    void* m_ctx = nullptr;
+#else
     ucontext_t m_ctx;
-    
+#endif
+
     void* m_stack = nullptr;
 
+    // allocator which m_stack is obtained from
+    StackAllocatorType m_stackAllocator = StackAllocatorType::MMAP;
+
+    StackMode m_stackMode = StackMode::PRIVATE;
+
+    // shared stack the coroutine runs on
+    SharedStack* m_sharedStack = nullptr;
+
+    // thread owning m_sharedStack
+    int m_boundThread = -1;
+
+    // task group of the scheduler that last ran the coroutine, it is queued
+    // there again when woken up
+    TaskGroup* m_group = nullptr;
+
+    // bytes at the bottom of the stack still holding the watermark pattern
+    uint32_t m_stackClean = 0;
+
+    // stack was painted and has not been measured since
+    bool m_stackPainted = false;
+
+    // live frames of a suspended shared-stack coroutine
+    char* m_savedStack = nullptr;
+    size_t m_savedSize = 0;
+    size_t m_savedCapacity = 0;
+
     // called method in coroutine
-    std::function<void()> m_cb;
+    Callable m_cb;
+
+    // values of FiberLocal variables, indexed by slot
+    void* m_locals[LOCAL_SLOTS] = {};
 };
 
 }
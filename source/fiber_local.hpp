@@ -0,0 +1,63 @@
+#ifndef __SERVER_FIBER_LOCAL_HPP__
+#define __SERVER_FIBER_LOCAL_HPP__
+
+#include <utility>
+
+#include "fiber.hpp"
+
+namespace Server {
+
+// variable with one value per coroutine, it follows the coroutine across
+// threads; the value is created on first access in a coroutine and freed
+// when the coroutine terminates or is reset. each variable takes one of
+// Fiber::LOCAL_SLOTS slots for the lifetime of the process, so declare
+// them with static storage duration
+template<typename T>
+class FiberLocal {
+public:
+    FiberLocal() : m_index{ Fiber::registerLocal(&FiberLocal::destroy) } {}
+
+    FiberLocal(const FiberLocal&) = delete;
+    FiberLocal& operator=(const FiberLocal&) = delete;
+
+    // value of current coroutine, default constructed on first access
+    T& get() {
+        void*& slot = Fiber::current()->m_locals[m_index];
+        if (!slot) {
+            slot = new T();
+        }
+        return *static_cast<T*>(slot);
+    }
+
+    void set(T value) { get() = std::move(value); }
+
+    // whether current coroutine holds a value
+    bool has() const { return Fiber::current()->m_locals[m_index] != nullptr; }
+
+    // free the value of current coroutine
+    void reset() {
+        void*& slot = Fiber::current()->m_locals[m_index];
+        if (slot) {
+            void* value = slot;
+            slot = nullptr;
+            destroy(value);
+        }
+    }
+
+    T& operator*() { return get(); }
+
+    T* operator->() { return &get(); }
+
+private:
+    static void destroy(void* value) {
+        delete static_cast<T*>(value);
+    }
+
+private:
+    // slot of the variable in every coroutine
+    size_t m_index;
+};
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include "fiber_sync.hpp"
+#include "log.hpp"
+#include "macro.hpp"
+#include "scheduler.hpp"
+
+namespace Server {
+
+// whether current code runs in a coroutine that its scheduler can resume,
+// the scheduling loop itself and plain threads have to block instead
+static bool canYield() {
+    Fiber* main = Scheduler::getMainFiber();
+    uint64_t id = Fiber::getFiberId();
+    return Scheduler::getThis() && main && id != 0 && id != main->getId();
+}
+
+void FiberWaitQueue::Waiter::prepare(Semaphore* s) {
+    if (canYield()) {
+        // the waker writes this node and the payload while the stack they
+        // live on belongs to another coroutine
+        SERVER_ASSERT_INFO(!Fiber::onSharedStack(),
+                           "shared-stack coroutine id = " + std::to_string(Fiber::getFiberId())
+                           + " cannot park on a FiberWaitQueue");
+        fiber = Fiber::getThis();
+        scheduler = Scheduler::getThis();
+    } else {
+        sem = s;
+    }
+}
+
+void FiberWaitQueue::Waiter::sleep() {
+    if (sem) {
+        sem->wait();
+    } else {
+        // the waker may schedule us before we are off the stack, the
+        // scheduler does not resume a coroutine that is still EXEC
+        Fiber::yieldToHold();
+    }
+}
+
+void FiberWaitQueue::Waiter::wake() {
+    // the waiter may return and free this node as soon as it is resumed
+    if (sem) {
+        sem->notify();
+    } else {
+        Scheduler* sc = scheduler;
+        sc->schedule(std::move(fiber));
+    }
+}
+
+bool FiberWaitQueue::Waiter::claim() {
+    int expected = -1;
+    return !selected || selected->compare_exchange_strong(expected, index);
+}
+
+void FiberWaitQueue::push(Waiter* w) {
+    w->prev = m_tail;
+    w->next = nullptr;
+    if (m_tail) {
+        m_tail->next = w;
+    } else {
+        m_head = w;
+    }
+    m_tail = w;
+    w->linked = true;
+}
+
+void FiberWaitQueue::remove(Waiter* w) {
+    if (!w->linked) {
+        return;
+    }
+
+    if (w->prev) {
+        w->prev->next = w->next;
+    } else {
+        m_head = w->next;
+    }
+
+    if (w->next) {
+        w->next->prev = w->prev;
+    } else {
+        m_tail = w->prev;
+    }
+    w->prev = w->next = nullptr;
+    w->linked = false;
+}
+
+void FiberWaitQueue::park(Spinlock::Lock& lock) {
+    Semaphore sem;
+    Waiter w;
+    w.prepare(&sem);
+    push(&w);
+    lock.unlock();
+    w.sleep();
+}
+
+FiberWaitQueue::Waiter* FiberWaitQueue::pop() {
+    Waiter* w = m_head;
+    if (w) {
+        remove(w);
+    }
+    return w;
+}
+
+FiberWaitQueue::Waiter* FiberWaitQueue::popClaimed() {
+    while (Waiter* w = pop()) {
+        if (w->claim()) {
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+FiberWaitQueue::Waiter* FiberWaitQueue::popAll() {
+    Waiter* head = m_head;
+    for (Waiter* w = head; w; w = w->next) {
+        w->linked = false;
+    }
+    m_head = m_tail = nullptr;
+    return head;
+}
+
+void FiberWaitQueue::wakeAll(Waiter* w) {
+    while (w) {
+        Waiter* next = w->next;
+        w->wake();
+        w = next;
+    }
+}
+
+void FiberMutex::lock() {
+    uint32_t expected = UNLOCKED;
+    if (m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)) {
+        return;
+    }
+
+    Spinlock::Lock lock(m_mutex);
+    // mark contended so unlock takes the slow path and wakes us
+    if (m_state.exchange(CONTENDED, std::memory_order_acquire) == UNLOCKED) {
+        // released in the meantime, the lock is ours
+        if (m_waiters.empty()) {
+            m_state.store(LOCKED, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // unlock() hands the lock over before waking us
+    m_waiters.park(lock);
+}
+
+bool FiberMutex::tryLock() {
+    uint32_t expected = UNLOCKED;
+    return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+}
+
+void FiberMutex::unlock() {
+    uint32_t expected = LOCKED;
+    if (m_state.compare_exchange_strong(expected, UNLOCKED, std::memory_order_release)) {
+        return;
+    }
+
+    Spinlock::Lock lock(m_mutex);
+    FiberWaitQueue::Waiter* w = m_waiters.pop();
+    if (!w) {
+        m_state.store(UNLOCKED, std::memory_order_release);
+        return;
+    }
+
+    // keep the mutex locked, ownership passes to the waiter
+    if (m_waiters.empty()) {
+        m_state.store(LOCKED, std::memory_order_relaxed);
+    }
+    lock.unlock();
+    w->wake();
+}
+
+void FiberCondVar::wait(FiberMutex::Lock& lock) {
+    Spinlock::Lock spin(m_mutex);
+    // queue before releasing the mutex so a notify in between is not lost
+    lock.unlock();
+    m_waiters.park(spin);
+    lock.lock();
+}
+
+void FiberCondVar::notifyOne() {
+    Spinlock::Lock lock(m_mutex);
+    FiberWaitQueue::Waiter* w = m_waiters.pop();
+    lock.unlock();
+    if (w) {
+        w->wake();
+    }
+}
+
+void FiberCondVar::notifyAll() {
+    FiberWaitQueue::Waiter* waiters = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        waiters = m_waiters.popAll();
+    }
+    FiberWaitQueue::wakeAll(waiters);
+}
+
+void FiberSemaphore::wait() {
+    if (tryWait()) {
+        return;
+    }
+
+    Spinlock::Lock lock(m_mutex);
+    if (tryWait()) {
+        return;
+    }
+
+    // notify() passes the permit to us directly
+    m_waiters.park(lock);
+}
+
+bool FiberSemaphore::tryWait() {
+    // permits are only added under the spinlock when nobody waits,
+    // so taking one does not need it
+    size_t count = m_count.load(std::memory_order_relaxed);
+    while (count > 0) {
+        if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberSemaphore::notify(size_t n) {
+    for (; n > 0; --n) {
+        Spinlock::Lock lock(m_mutex);
+        FiberWaitQueue::Waiter* w = m_waiters.pop();
+        if (!w) {
+            // nobody waits, keep the rest of the permits
+            m_count.fetch_add(n, std::memory_order_release);
+            return;
+        }
+
+        lock.unlock();
+        w->wake();
+    }
+}
+
+void WaitGroup::add(int64_t n) {
+    // a counter staying above zero changes without the spinlock
+    int64_t count = m_count.load(std::memory_order_relaxed);
+    while (count + n > 0) {
+        if (m_count.compare_exchange_weak(count, count + n, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+
+    // zero is only reached under the spinlock, which wait() takes before it
+    // returns, so a waiter freeing the group cannot overlap with us
+    FiberWaitQueue::Waiter* waiters = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        count = m_count.fetch_add(n, std::memory_order_acq_rel) + n;
+        SERVER_ASSERT_INFO(count >= 0, "negative WaitGroup counter");
+        if (count == 0) {
+            waiters = m_waiters.popAll();
+        }
+    }
+    FiberWaitQueue::wakeAll(waiters);
+}
+
+void WaitGroup::done() {
+    add(-1);
+}
+
+void WaitGroup::wait() {
+    // a zero read without the spinlock may come from a done() still holding it
+    Spinlock::Lock lock(m_mutex);
+    if (m_count.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    m_waiters.park(lock);
+}
+
+}
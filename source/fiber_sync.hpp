@@ -0,0 +1,184 @@
+#ifndef __SERVER_FIBER_SYNC_HPP__
+#define __SERVER_FIBER_SYNC_HPP__
+
+#include <atomic>
+
+#include "fiber.hpp"
+#include "mutex.hpp"
+
+namespace Server {
+
+class Scheduler;
+
+// coroutines (or threads) parked on a synchronization primitive, guarded
+// by the spinlock of the primitive. a coroutine run by a Scheduler yields
+// and is scheduled again when woken; any other caller blocks its thread.
+// waiters live on the stack of the parked caller, so parking allocates nothing
+// and a coroutine with a shared stack cannot park
+class FiberWaitQueue {
+public:
+    struct Waiter {
+        // parked coroutine and the scheduler resuming it
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+
+        // parked thread
+        Semaphore* sem = nullptr;
+
+        // payload exchanged between the waiter and its waker
+        void* data = nullptr;
+
+        // set by the waker, false when the primitive was closed
+        bool ok = false;
+
+        // waiters of one select share the token, it holds the index of the
+        // case that fired or -1 while none did
+        std::atomic<int>* selected = nullptr;
+        int index = 0;
+
+        Waiter* prev = nullptr;
+        Waiter* next = nullptr;
+        bool linked = false;
+
+        // bind the waiter to current coroutine, or to sem if it cannot yield
+        void prepare(Semaphore* sem);
+
+        // park until wake() is called, the spinlock must be released before
+        void sleep();
+
+        // resume the waiter, must be called without the spinlock held
+        void wake();
+
+        // take the waiter for waking, false if another case of its select won
+        bool claim();
+    };
+
+    bool empty() const { return !m_head; }
+
+    void push(Waiter* w);
+
+    // unlink w if it is still queued
+    void remove(Waiter* w);
+
+    // enqueue current coroutine or thread, release lock and park until woken
+    void park(Spinlock::Lock& lock);
+
+    // dequeue the longest waiting waiter, nullptr if the queue is empty
+    Waiter* pop();
+
+    // dequeue the longest waiting waiter that can be claimed, waiters whose
+    // select already fired elsewhere are dropped
+    Waiter* popClaimed();
+
+    // dequeue all waiters as a chain linked by next
+    Waiter* popAll();
+
+    // wake a chain returned by popAll
+    static void wakeAll(Waiter* w);
+
+private:
+    Waiter* m_head = nullptr;
+    Waiter* m_tail = nullptr;
+};
+
+// mutex that parks only the calling coroutine, the lock is handed directly
+// to the first waiter on unlock. uncontended lock/unlock is a single CAS
+class FiberMutex {
+public:
+    using Lock = ScopedLock<FiberMutex>;
+
+    FiberMutex() = default;
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+
+    void lock();
+
+    bool tryLock();
+
+    void unlock();
+
+private:
+    enum : uint32_t {
+        UNLOCKED = 0,
+        LOCKED = 1,
+        CONTENDED = 2   // locked and waiters may be queued
+    };
+
+    std::atomic<uint32_t> m_state{ UNLOCKED };
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+// condition variable for FiberMutex
+class FiberCondVar {
+public:
+    FiberCondVar() = default;
+    FiberCondVar(const FiberCondVar&) = delete;
+    FiberCondVar& operator=(const FiberCondVar&) = delete;
+
+    // release lock, park until notified, then lock again
+    void wait(FiberMutex::Lock& lock);
+
+    template<typename Predicate>
+    void wait(FiberMutex::Lock& lock, Predicate pred) {
+        while (!pred()) {
+            wait(lock);
+        }
+    }
+
+    void notifyOne();
+
+    void notifyAll();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+// counting semaphore, a released permit is handed directly to a waiter
+class FiberSemaphore {
+public:
+    explicit FiberSemaphore(size_t count = 0) : m_count{ count } {}
+    FiberSemaphore(const FiberSemaphore&) = delete;
+    FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+    void wait();
+
+    bool tryWait();
+
+    void notify(size_t n = 1);
+
+    // permits currently available
+    size_t getCount() const { return m_count; }
+
+private:
+    Spinlock m_mutex;
+    std::atomic<size_t> m_count;
+    FiberWaitQueue m_waiters;
+};
+
+// wait for a group of tasks to finish: add() before starting each task,
+// done() when it finishes, wait() parks until the counter drops to zero
+class WaitGroup {
+public:
+    explicit WaitGroup(int64_t count = 0) : m_count{ count } {}
+    WaitGroup(const WaitGroup&) = delete;
+    WaitGroup& operator=(const WaitGroup&) = delete;
+
+    void add(int64_t n = 1);
+
+    void done();
+
+    void wait();
+
+    int64_t getCount() const { return m_count; }
+
+private:
+    std::atomic<int64_t> m_count;
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+}
+
+#endif
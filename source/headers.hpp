@@ -9,6 +9,13 @@
 #include "macro.hpp"
 #include "mutex"
 #include "fiber.hpp"
+#include "fiber_local.hpp"
+#include "fiber_sync.hpp"
+#include "channel.hpp"
 #include "scheduler.hpp"
+#include "parallel.hpp"
+#include "offload.hpp"
+#include "timer.hpp"
+#include "poller.hpp"
 
 #endif
\ No newline at end of file
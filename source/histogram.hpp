@@ -0,0 +1,133 @@
+#ifndef __SERVER_HISTOGRAM_HPP__
+#define __SERVER_HISTOGRAM_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace Server {
+
+// add to a counter only one thread writes to, a plain store instead of an
+// atomic read-modify-write
+inline void bump(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// lock-free histogram of unsigned values with power-of-two buckets,
+// bucket 0 counts zero, bucket i counts values in [2^(i-1), 2^i)
+class Log2Histogram {
+public:
+    static const size_t BUCKET_COUNT = 65;
+
+    // bucket a value falls into
+    static size_t bucketOf(uint64_t value) {
+        return value ? 64 - __builtin_clzll(value) : 0;
+    }
+
+    // smallest value counted by bucket i
+    static uint64_t bucketLow(size_t i) {
+        return i ? static_cast<uint64_t>(1) << (i - 1) : 0;
+    }
+
+    void add(uint64_t value) {
+        m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t cur = m_max.load(std::memory_order_relaxed);
+        while (cur < value && !m_max.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+    }
+
+    // add for a histogram only one thread writes to, e.g. a per-thread shard,
+    // plain stores instead of atomic read-modify-writes
+    void addUnshared(uint64_t value) {
+        bump(m_buckets[bucketOf(value)], 1);
+        bump(m_count, 1);
+        bump(m_sum, value);
+        if (m_max.load(std::memory_order_relaxed) < value) {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // add the values counted by oth, e.g. to sum up per-thread shards
+    void merge(const Log2Histogram& oth) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            m_buckets[i].fetch_add(oth.bucketCount(i), std::memory_order_relaxed);
+        }
+        m_count.fetch_add(oth.count(), std::memory_order_relaxed);
+        m_sum.fetch_add(oth.sum(), std::memory_order_relaxed);
+
+        uint64_t value = oth.max();
+        uint64_t cur = m_max.load(std::memory_order_relaxed);
+        while (cur < value && !m_max.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+    }
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    uint64_t bucketCount(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+
+    // upper bound of the bucket holding the p-th quantile (p in [0, 1]),
+    // capped by the largest value seen
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (!total) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(p * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += bucketCount(i);
+            if (seen > rank) {
+                uint64_t high = i < 64 ? (static_cast<uint64_t>(1) << i) - 1 : UINT64_MAX;
+                return std::min(high, max());
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto& i : m_buckets) {
+            i.store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    // summary line followed by one line per non-empty bucket
+    std::string toString() const {
+        std::stringstream ss;
+        uint64_t total = count();
+        ss << "count=" << total
+           << " avg=" << (total ? sum() / total : 0)
+           << " p50=" << percentile(0.5)
+           << " p99=" << percentile(0.99)
+           << " max=" << max();
+
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            uint64_t n = bucketCount(i);
+            if (n) {
+                ss << std::endl << "  [" << bucketLow(i) << ", "
+                   << (i < 64 ? bucketLow(i + 1) : UINT64_MAX) << ") " << n;
+            }
+        }
+        return ss.str();
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+}
+
+#endif
@@ -1,9 +1,9 @@
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/epoll.h>
+#include <poll.h>
 #include <errno.h>
 #include <string.h>
 #include "iomanager.hpp"
+#include "config.hpp"
 #include "macro.hpp"
 #include "log.hpp"
 
@@ -11,6 +11,11 @@ namespace Server {
 
 static Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
+static ConfigArg<std::string>::ptr g_poller =
+    ConfigMgr::lookUp<std::string>("iomanager.poller", "epoll",
+                                   "readiness backend of IOManager (epoll, io_uring, auto), "
+                                   "io_uring falls back to epoll when the kernel lacks it");
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(Event event){
     switch(event) {
         case IOManager::READ:
@@ -26,6 +31,7 @@ void IOManager::FdContext::resetContext(EventContext& ctx){
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.handle = nullptr;
 };
 
 void IOManager::FdContext::triggerEvent(Event event){
@@ -36,6 +42,9 @@ void IOManager::FdContext::triggerEvent(Event event){
 
     if (ctx.cb) {
         ctx.scheduler->schedule(&ctx.cb);
+    } else if (ctx.handle) {
+        ctx.scheduler->schedule(ctx.handle);
+        ctx.handle = nullptr;
     } else {
         ctx.scheduler->schedule(&ctx.fiber);
     }
@@ -46,22 +55,8 @@ void IOManager::FdContext::triggerEvent(Event event){
 
 IOManager::IOManager(size_t threads, bool useCaller, const std::string& name)
     :Scheduler(threads, useCaller, name) {
-    m_epfd = epoll_create(5000);
-    SERVER_ASSERT(m_epfd > 0);
-
-    int ret = pipe(m_notifyFds);
-    SERVER_ASSERT(!ret);
-
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_notifyFds[0];
-
-    ret = fcntl(m_notifyFds[0], F_SETFL, O_NONBLOCK);
-    SERVER_ASSERT(!ret);
-
-    ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_notifyFds[0], &event);
-    SERVER_ASSERT(!ret);
+    m_poller = Poller::create(g_poller->getValue());
+    SERVER_LOG_INFO(g_logger) << "name=" << getName() << " poller=" << m_poller->getName();
 
     // initialize fd context 
     contextResize(32);
@@ -71,9 +66,7 @@ IOManager::IOManager(size_t threads, bool useCaller, const std::string& name)
 
 IOManager::~IOManager(){
     stop();
-    close(m_epfd);
-    close(m_notifyFds[0]);
-    close(m_notifyFds[1]);
+    m_poller.reset();
 
     for (size_t i = 0; i < m_fdContexts.size(); ++i) {
         if (m_fdContexts[i]) {
@@ -94,20 +87,31 @@ void IOManager::contextResize(size_t size) {
 }
 
 // -1 error, 0 success
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
-    FdContext* fdCtx = nullptr;
+int IOManager::addEvent(int fd, Event event, Callable cb){
+    return addEventContext(fd, event, &cb, nullptr);
+}
+
+int IOManager::addEvent(int fd, Event event, std::coroutine_handle<> handle){
+    return addEventContext(fd, event, nullptr, handle);
+}
+
+IOManager::FdContext* IOManager::getFdContext(int fd) {
     RWMutexType::ReadLock lock(m_mtx);
     if (static_cast<int>(m_fdContexts.size()) > fd) {
-        fdCtx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        // update m_fdContexts using write lock
-        RWMutexType::WriteLock lock2(m_mtx);
+        return m_fdContexts[fd];
+    }
+    lock.unlock();
+
+    // update m_fdContexts using write lock
+    RWMutexType::WriteLock lock2(m_mtx);
+    if (static_cast<int>(m_fdContexts.size()) <= fd) {
         contextResize(fd * 1.5);   // TODO: resize according to fd 
-        fdCtx = m_fdContexts[fd];
     }
+    return m_fdContexts[fd];
+}
 
+int IOManager::addEventContext(int fd, Event event, Callable* cb, std::coroutine_handle<> handle){
+    FdContext* fdCtx = getFdContext(fd);
     FdContext::MutexType::Lock lock2(fdCtx->mtx);
     if (fdCtx->events & event) {
         SERVER_LOG_ERROR(g_logger) << "addEvent assert fd = " << fd
@@ -117,29 +121,24 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
         SERVER_ASSERT(!(fdCtx->events & event));
     }
 
-    int op = fdCtx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event ep_event;
-    ep_event.events = EPOLLET | fdCtx->events | event;
-    ep_event.data.ptr = fdCtx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &ep_event);
-    if (ret) {
-        // errno, macro indicate error conditions within program when dealing with system calls and library function
-        SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
-                                << op << "," << fd << "," << ep_event.events << "):"
-                                << ret << " (" << errno << ") (" << strerror(errno) << ")";
-
+    int events = fdCtx->events | event;
+    bool ok = fdCtx->events ? m_poller->modify(fd, events, fdCtx)
+                            : m_poller->add(fd, events, fdCtx);
+    if (!ok) {
+        logPollerError(fdCtx->events ? "modify" : "add", fd, events);
         return -1;
     }
 
     ++m_pendingEventCount;
     fdCtx->events = static_cast<Event>(fdCtx->events | event);
     FdContext::EventContext& eventCtx = fdCtx->getContext(event);
-    SERVER_ASSERT(!(eventCtx.scheduler || eventCtx.fiber || eventCtx.cb));
+    SERVER_ASSERT(!(eventCtx.scheduler || eventCtx.fiber || eventCtx.cb || eventCtx.handle));
 
     eventCtx.scheduler = Scheduler::getThis();
-    if (cb) {
-        eventCtx.cb.swap(cb);
+    if (cb && *cb) {
+        eventCtx.cb = std::move(*cb);
+    } else if (handle) {
+        eventCtx.handle = handle;
     } else {
         eventCtx.fiber = Fiber::getThis();
         SERVER_ASSERT(eventCtx.fiber->getState() == Fiber::State::EXEC);
@@ -164,17 +163,10 @@ bool IOManager::delEvent(int fd, Event event){
 
     Event new_event = static_cast<Event>(fd_ctx->events & ~event);
     
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event ep_event;
-    ep_event.events = EPOLLET | new_event;
-    ep_event.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &ep_event);
-    if (ret) {
-        SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
-                                << op << "," << fd << "," << ep_event.events << "):"
-                                << ret << " (" << errno << ") (" << strerror(errno) << ")";
-
+    bool ok = new_event ? m_poller->modify(fd, new_event, fd_ctx)
+                        : m_poller->remove(fd, fd_ctx);
+    if (!ok) {
+        logPollerError(new_event ? "modify" : "remove", fd, new_event);
         return false;
     }
 
@@ -195,36 +187,31 @@ bool IOManager::cancelEvent(int fd, Event event){
     lock.unlock();
     
     FdContext::MutexType::Lock lock2(fd_ctx->mtx);
+    bool cancelled = cancelIo(fd_ctx, event);
     if(!(fd_ctx->events & event)) {
-        return false;
+        return cancelled;
     }
 
     Event new_event = static_cast<Event>(fd_ctx->events & ~event);
     
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event ep_event;
-    ep_event.events = EPOLLET | new_event;
-    ep_event.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &ep_event);
-    if (ret) {
-        SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
-                                << op << "," << fd << "," << ep_event.events << "):"
-                                << ret << " (" << errno << ") (" << strerror(errno) << ")";
-
+    bool ok = new_event ? m_poller->modify(fd, new_event, fd_ctx)
+                        : m_poller->remove(fd, fd_ctx);
+    if (!ok) {
+        logPollerError(new_event ? "modify" : "remove", fd, new_event);
         return false;
     }
 
     fd_ctx->triggerEvent(event);
     --m_pendingEventCount;
 
-    SERVER_ASSERT(fd_ctx->events == NONE);
+    // the other direction may still be waited for
+    SERVER_ASSERT(!(fd_ctx->events & event));
     return true;
 };
 
 bool IOManager::cancelAll(int fd){
     RWMutexType::ReadLock lock(m_mtx);
-    if (static_cast<int>(m_fdContexts.size()) < fd) {
+    if (static_cast<int>(m_fdContexts.size()) <= fd) {
         return false;
     }
 
@@ -232,21 +219,13 @@ bool IOManager::cancelAll(int fd){
     lock.unlock();
     
     FdContext::MutexType::Lock lock2(fd_ctx->mtx);
+    bool cancelled = cancelIo(fd_ctx, READ | WRITE);
     if(!fd_ctx->events ) {
-        return false;
+        return cancelled;
     }
     
-    int op = EPOLL_CTL_DEL;
-    epoll_event ep_event;
-    ep_event.events = 0;
-    ep_event.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &ep_event);
-    if (ret) {
-        SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
-                                << op << "," << fd << "," << ep_event.events << "):"
-                                << ret << " (" << errno << ") (" << strerror(errno) << ")";
-
+    if (!m_poller->remove(fd, fd_ctx)) {
+        logPollerError("remove", fd, 0);
         return false;
     }
 
@@ -265,6 +244,197 @@ bool IOManager::cancelAll(int fd){
     return true;
 };
 
+void IOManager::logPollerError(const char* op, int fd, int events) {
+    // errno, macro indicate error conditions within program when dealing with system calls and library function
+    SERVER_LOG_ERROR(g_logger) << m_poller->getName() << " " << op << " (" << fd << ","
+                            << events << "): (" << errno << ") (" << strerror(errno) << ")";
+}
+
+ssize_t IOManager::recv(int fd, void* buf, size_t len, int flags) {
+    Poller::Request req{ Poller::Op::RECV, fd, buf, len, flags };
+    return doIo(req, READ);
+}
+
+ssize_t IOManager::send(int fd, const void* buf, size_t len, int flags) {
+    Poller::Request req{ Poller::Op::SEND, fd, const_cast<void*>(buf), len, flags };
+    return doIo(req, WRITE);
+}
+
+int IOManager::accept(int fd, sockaddr* addr, socklen_t* addrlen, int flags) {
+    Poller::Request req{ Poller::Op::ACCEPT, fd, nullptr, 0, flags, addr, addrlen };
+    return doIo(req, READ);
+}
+
+ssize_t IOManager::doIo(const Poller::Request& req, Event event) {
+    Fiber* main = Scheduler::getMainFiber();
+    SERVER_ASSERT_INFO(Scheduler::getThis() && main && Fiber::getFiberId() != main->getId(),
+                       "IOManager io must run in a coroutine of a scheduler");
+    Fiber::ptr cur = Fiber::getThis();
+
+    // cancelEvent() writes the request while its coroutine is parked, the
+    // frames of a shared stack are not in place then
+    bool shared = cur->getStackMode() == Fiber::StackMode::SHARED;
+    IoRequest local;
+    std::unique_ptr<IoRequest> heap;
+    IoRequest* io = &local;
+    if (shared) {
+        heap.reset(new IoRequest);
+        io = heap.get();
+    }
+    io->scheduler = Scheduler::getThis();
+    io->ctx = getFdContext(req.fd);
+    io->event = event;
+
+    {
+        FdContext::MutexType::Lock lock(io->ctx->mtx);
+        linkIo(io);
+        // the kernel writes a shared stack while other coroutines own it,
+        // such a coroutine makes the call itself. submitted under the fd
+        // mutex, so a cancel finds the request in the poller
+        if (!shared) {
+            io->fiber = cur;
+            ++m_pendingEventCount;
+            io->submitted = m_poller->submit(req, io);
+            if (!io->submitted) {
+                --m_pendingEventCount;
+                io->fiber.reset();
+            }
+        }
+    }
+    cur.reset();
+
+    if (io->submitted) {
+        // idle() unlinks the request before it resumes us
+        Fiber::yieldToHold();
+        if (io->result >= 0) {
+            return io->result;
+        }
+
+        if (io->cancelled || io->result != -EAGAIN) {
+            errno = io->cancelled ? ECANCELED : -io->result;
+            return -1;
+        }
+
+        // a socket that cannot wait inside the kernel falls back below
+        FdContext::MutexType::Lock lock(io->ctx->mtx);
+        io->submitted = false;
+        linkIo(io);
+    }
+
+    ssize_t ret = -1;
+    while (true) {
+        if (io->cancelled) {
+            errno = ECANCELED;
+            ret = -1;
+            break;
+        }
+
+        switch (req.op) {
+            case Poller::Op::RECV:
+                ret = ::recv(req.fd, req.buf, req.len, req.flags | MSG_DONTWAIT);
+                break;
+            case Poller::Op::SEND:
+                ret = ::send(req.fd, req.buf, req.len, req.flags | MSG_DONTWAIT);
+                break;
+            case Poller::Op::ACCEPT:
+                ret = ::accept4(req.fd, req.addr, req.addrlen, req.flags);
+                break;
+        }
+
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        }
+
+        if (addEvent(req.fd, event)) {
+            ret = -1;
+            break;
+        }
+
+        // a cancel before the registration had no event to trigger
+        if (io->cancelled) {
+            cancelEvent(req.fd, event);
+        }
+        Fiber::yieldToHold();
+    }
+
+    int savedErrno = errno;
+    {
+        FdContext::MutexType::Lock lock(io->ctx->mtx);
+        unlinkIo(io);
+    }
+    errno = savedErrno;
+    return ret;
+}
+
+void IOManager::linkIo(IoRequest* io) {
+    FdContext* ctx = io->ctx;
+    io->prev = nullptr;
+    io->next = ctx->ios;
+    if (ctx->ios) {
+        ctx->ios->prev = io;
+    }
+    ctx->ios = io;
+    ++m_pendingIoCount;
+}
+
+void IOManager::unlinkIo(IoRequest* io) {
+    FdContext* ctx = io->ctx;
+    if (io->prev) {
+        io->prev->next = io->next;
+    } else {
+        ctx->ios = io->next;
+    }
+
+    if (io->next) {
+        io->next->prev = io->prev;
+    }
+    io->prev = io->next = nullptr;
+    --m_pendingIoCount;
+}
+
+bool IOManager::cancelIo(FdContext* ctx, int events) {
+    bool found = false;
+    for (IoRequest* io = ctx->ios; io; io = io->next) {
+        if (!(io->event & events) || io->cancelled) {
+            continue;
+        }
+
+        found = true;
+        io->cancelled = true;
+        if (io->submitted) {
+            m_poller->cancel(io);
+        }
+    }
+    return found;
+}
+
+void IOManager::cancelAllIo() {
+    // fds and the events their requests wait for
+    std::vector<std::pair<int, int>> fds;
+    {
+        RWMutexType::ReadLock lock(m_mtx);
+        for (FdContext* ctx : m_fdContexts) {
+            FdContext::MutexType::Lock lock2(ctx->mtx);
+            int events = NONE;
+            for (IoRequest* io = ctx->ios; io; io = io->next) {
+                events |= io->event;
+            }
+            if (events) {
+                fds.emplace_back(ctx->fd, events);
+            }
+        }
+    }
+
+    for (auto& i : fds) {
+        if (i.second & READ) {
+            cancelEvent(i.first, READ);
+        }
+        if (i.second & WRITE) {
+            cancelEvent(i.first, WRITE);
+        }
+    }
+}
+
 IOManager* IOManager::getThis(){
     // retrieve smart pointer from Schduler::getThis() (i.e return a static pointer to scheduler)
     return dynamic_cast<IOManager*>(Scheduler::getThis());
@@ -275,20 +445,40 @@ void IOManager::notify() {
         return;
     }
 
-    int ret = write(m_notifyFds[1], "T", 1);
-    SERVER_ASSERT(ret == 1);
+    // a parked worker takes the task, otherwise wake the one in the poller
+    if (!unparkOne()) {
+        notifyPoller();
+    }
+}
+
+void IOManager::notifyPoller() {
+    countNotify();
+
+    // a wakeup still pending reaches the poller anyway. the fence orders the
+    // task queued before against the flag, pairing with the one in idle():
+    // either the poller sees the task or this sees the flag cleared
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_notifyPending.load(std::memory_order_relaxed) || m_notifyPending.exchange(true)) {
+        return;
+    }
+
+    m_poller->notify();
+    countWakeup();
 }
 
 bool IOManager::stopped() {
     return Scheduler::stopped()
-        && m_pendingEventCount == 0;
+        && m_pendingEventCount == 0
+        && !hasTimer();
+}
+
+void IOManager::onTimerInsertedAtFront() {
+    notifyPoller();
 }
 
 void IOManager::idle() {
-    epoll_event* events = new epoll_event[64]();
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
-        delete[] ptr;
-    });
+    static const int MAX_EVENTS = 64;
+    std::vector<Poller::Event> events(MAX_EVENTS);
 
     while(true) {
         if (stopped()) {
@@ -296,40 +486,93 @@ void IOManager::idle() {
             break;
         }
 
+        static const int MAX_TIMEOUT = 5000;
+
+        // one worker polls, the others park until handed a task or the
+        // poller is free again
+        bool polling = false;
+        if (!m_polling.compare_exchange_strong(polling, true)) {
+            // a follower of an elastic pool idle long enough ends its thread
+            int64_t timeout = retireTimeout();
+            if (!parkWorker(timeout < 0 ? MAX_TIMEOUT : timeout,
+                            [this]() { return m_polling && !stopped(); })
+                && tryRetire()) {
+                break;
+            }
+
+            Fiber::ptr cur = Fiber::getThis();
+            auto raw_ptr = cur.get();
+            cur.reset();
+
+            raw_ptr->swapOut();
+            continue;
+        }
+
+        // only parked requests are left, abort them so the workers can leave
+        if (m_pendingIoCount && Scheduler::stopped()) {
+            cancelAllIo();
+        }
+
         int ret = 0;
+        setPolling(true);
+        if (!hasPendingWork()) {
+            // sleep until the next timer is due
+            uint64_t next = getNextTimer();
+            int timeout = next > MAX_TIMEOUT ? MAX_TIMEOUT : static_cast<int>(next);
+            ret = m_poller->wait(events.data(), MAX_EVENTS, timeout);
+        }
+        setPolling(false);
 
-        do {
-            static const int MAX_TIMEOUT = 5000;
-            ret = epoll_wait(m_epfd, events, 64, MAX_TIMEOUT);
-            
-            if (ret < 0 && errno == EINTR) {
+        // hand polling over while this worker runs what it woke up
+        m_polling = false;
+        unparkOne();
 
-            } else {
-                break;
-            }
-        } while (true);
+        std::vector<Callable> cbs;
+        listExpiredCb(cbs);
+        if (!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+        }
 
         for (int i = 0; i < ret; ++i) {
-            epoll_event& event = events[i];
+            Poller::Event& event = events[i];
+
+            if (!event.data) {
+                // the poller has consumed the notify. the flag is cleared after
+                // it: a notify skipped in between finds this worker awake, it
+                // checks the queues and timers again before it waits
+                m_notifyPending.store(false, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                continue;
+            }
 
-            if (event.data.fd == m_notifyFds[0]) {
-                uint8_t dummy;
-                while (read(m_notifyFds[0], &dummy, 1) == 1);
+            if (event.completed) {
+                // the coroutine may return and free the request once scheduled
+                IoRequest* io = static_cast<IoRequest*>(event.data);
+                Scheduler* sc = io->scheduler;
+                Fiber::ptr fiber = std::move(io->fiber);
+                {
+                    FdContext::MutexType::Lock lock(io->ctx->mtx);
+                    unlinkIo(io);
+                }
+                io->result = event.result;
+                --m_pendingEventCount;
+                sc->schedule(std::move(fiber));
                 continue;
             }
 
-            FdContext* fd_ctx = static_cast<FdContext*>(event.data.ptr);
+            FdContext* fd_ctx = static_cast<FdContext*>(event.data);
             FdContext::MutexType::Lock lock(fd_ctx->mtx);
-            if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= EPOLLIN | EPOLLOUT;
+            if (event.events & (POLLERR | POLLHUP)) {
+                // wake whichever waiters are registered, not both directions
+                event.events |= (POLLIN | POLLOUT) & fd_ctx->events;
             }
 
             int real_events = NONE;
-            if (event.events & EPOLLIN) {
+            if (event.events & POLLIN) {
                 real_events |= READ;
             }
 
-            if (event.events & EPOLLOUT) {
+            if (event.events & POLLOUT) {
                 real_events |= WRITE;
             }
 
@@ -337,15 +580,10 @@ void IOManager::idle() {
                 continue;
 
             int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int ret2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if (ret2) {
-                SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
-                                    << op << "," << fd_ctx->fd << "," << event.events << "):"
-                                    << ret2 << " (" << errno << ") (" << strerror(errno) << ")";
-
+            bool ok = left_events ? m_poller->modify(fd_ctx->fd, left_events, fd_ctx)
+                                  : m_poller->remove(fd_ctx->fd, fd_ctx);
+            if (!ok) {
+                logPollerError(left_events ? "modify" : "remove", fd_ctx->fd, left_events);
                 continue;
             }
 
@@ -1,11 +1,13 @@
 #ifndef __SERVER_IOMANAGER_HPP__
 #define __SERVER_IOMANAGER_HPP__
 
+#include "poller.hpp"
 #include "scheduler.hpp"
+#include "timer.hpp"
 
 namespace Server {
 
-class IOManager : public Scheduler {
+class IOManager : public Scheduler, public TimerManager {
 public:
     using ptr = std::shared_ptr<IOManager>;
     using RWMutexType = RWMutex;
@@ -17,6 +19,28 @@ public:
     };
 
 private:
+    class FdContext;
+
+    // a recv, send or accept parked on an fd, lives on the stack of its
+    // coroutine unless that stack is shared
+    struct IoRequest {
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        int result = 0;
+
+        // fd and event the request waits for
+        FdContext* ctx = nullptr;
+        Event event = NONE;
+
+        // handed to the poller, otherwise it waits for readiness of event
+        bool submitted = false;
+        std::atomic<bool> cancelled{ false };
+
+        // links in the requests of the fd, guarded by its mutex
+        IoRequest* prev = nullptr;
+        IoRequest* next = nullptr;
+    };
+
     class FdContext  {
     public:
         using MutexType = Mutex;
@@ -29,7 +53,10 @@ private:
             Fiber::ptr fiber;
 
             // event callback
-            std::function<void()> cb;
+            Callable cb;
+
+            // event stackless coroutine
+            std::coroutine_handle<> handle;
         };      
 
         EventContext& getContext(Event event);
@@ -50,6 +77,9 @@ private:
         // registered event
         Event events = Event::NONE;
 
+        // requests of recv, send and accept waiting on the fd
+        IoRequest* ios = nullptr;
+
         // read-write lock
         MutexType mtx;
     };
@@ -59,30 +89,86 @@ public:
     ~IOManager();  
 
     // -1 error, 0 retry, 1 success
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Callable cb = nullptr);
+
+    // resume a C++20 coroutine on the current scheduler once the event fires
+    int addEvent(int fd, Event event, std::coroutine_handle<> handle);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
     bool cancelAll(int fd);
 
+    // recv, send and accept parking only the calling coroutine. the
+    // io_uring poller runs them in the kernel, with epoll the call is
+    // retried when fd is ready: recv and send pass MSG_DONTWAIT, accept
+    // needs a nonblocking socket. -1 with errno set on error, ECANCELED
+    // once cancelEvent() or cancelAll() drop the fd, READ for recv and
+    // accept, WRITE for send, or the IOManager stops
+    ssize_t recv(int fd, void* buf, size_t len, int flags = 0);
+    ssize_t send(int fd, const void* buf, size_t len, int flags = 0);
+    int accept(int fd, sockaddr* addr, socklen_t* addrlen, int flags = 0);
+
+    // backend chosen by iomanager.poller
+    const char* getPollerName() const { return m_poller->getName(); }
+
     static IOManager* getThis();
 
 protected:
     // notify task which can be executed
     void notify() override;
 
+    // interrupt the wait of the poller
+    void notifyPoller() override;
+
     // determine if the scheduler is stopped and executes all tasks in thread pool
     bool stopped() override;
 
     // used for a idle coroutine when no events in thread pool
     void idle() override;
 
+    // wake the poller so it waits for the new earliest timer
+    void onTimerInsertedAtFront() override;
+
     void contextResize(size_t size);
 
 private:
-    int m_epfd{ 0 };
-    int m_notifyFds[2];
+    // context of fd, created if fd is beyond the table
+    FdContext* getFdContext(int fd);
+
+    // track io in the requests of its fd, the fd mutex must be held
+    void linkIo(IoRequest* io);
+    void unlinkIo(IoRequest* io);
+
+    // cancel the requests of ctx waiting for events, the fd mutex must be
+    // held. those in the poller are aborted, the others see the flag once
+    // their readiness event is cancelled. false if there was none
+    bool cancelIo(FdContext* ctx, int events);
+
+    // cancel every request on stop, nothing else would complete them
+    void cancelAllIo();
+
+    // register event, the waiter is cb, handle or the current fiber in that order
+    int addEventContext(int fd, Event event, Callable* cb, std::coroutine_handle<> handle);
+
+    // run req through the poller, or make the call once fd is ready for event
+    ssize_t doIo(const Poller::Request& req, Event event);
+
+    // log a failed registration of the poller
+    void logPollerError(const char* op, int fd, int events);
+
+private:
+    Poller::ptr m_poller;
+
+    // set from the poller notify until the poller reports it, notifies in
+    // between have nothing to add and skip the syscall
+    std::atomic<bool> m_notifyPending{ false };
 
     std::atomic<size_t> m_pendingEventCount{ 0 };
+
+    // requests linked to an fd
+    std::atomic<size_t> m_pendingIoCount{ 0 };
+
+    // set while a worker waits in the poller, the other idle workers park
+    std::atomic<bool> m_polling{ false };
     RWMutexType m_mtx;
     std::vector<FdContext*> m_fdContexts;
 };
@@ -1,5 +1,9 @@
 #include "mutex.hpp"
 #include <stdexcept>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace Server {
 
@@ -26,5 +30,37 @@ void Semaphore::notify(){
     }
 };
 
-}
+void Parker::park(int64_t timeoutMs) {
+    // take a pending token, EMPTY turns into PARKED otherwise
+    if (m_state.fetch_sub(1, std::memory_order_acquire) == NOTIFIED) {
+        return;
+    }
+
+    int32_t* word = reinterpret_cast<int32_t*>(&m_state);
+    if (timeoutMs >= 0) {
+        timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, PARKED, &ts, nullptr, 0);
+
+        // woken, timed out or interrupted, a token arriving now is consumed too
+        m_state.exchange(EMPTY, std::memory_order_acquire);
+        return;
+    }
+
+    while (true) {
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, PARKED, nullptr, nullptr, 0);
+        int32_t notified = NOTIFIED;
+        if (m_state.compare_exchange_strong(notified, EMPTY, std::memory_order_acquire)) {
+            return;
+        }
+    }
+};
+
+void Parker::unpark() {
+    if (m_state.exchange(NOTIFIED, std::memory_order_release) == PARKED) {
+        syscall(SYS_futex, reinterpret_cast<int32_t*>(&m_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+};
 
+}
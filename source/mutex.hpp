@@ -2,6 +2,7 @@
 #define __SERVER_MUTEX_HPP__
 
 #include <atomic>
+#include <cstdint>
 #include <semaphore.h>
 
 namespace Server {
@@ -190,6 +191,31 @@ private:
     sem_t m_semaphore;  
 };
 
+// wakeup token of a single thread on a futex word, unpark() before park()
+// makes the next park() return at once
+class Parker {
+public:
+    Parker() = default;
+
+    // block until unpark(), or until timeoutMs passes if it is not negative
+    void park(int64_t timeoutMs = -1);
+
+    void unpark();
+
+private:
+    Parker(const Parker&) = delete;
+    Parker& operator=(const Parker&) = delete;
+
+private:
+    enum : int32_t {
+        PARKED = -1,
+        EMPTY = 0,
+        NOTIFIED = 1
+    };
+
+    std::atomic<int32_t> m_state{ EMPTY };
+};
+
 class Spinlock {
 public:
     using Lock = ScopedLock<Spinlock>;
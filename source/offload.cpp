@@ -0,0 +1,164 @@
+#include "offload.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+
+namespace Server {
+static Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+static ConfigArg<uint32_t>::ptr g_offloadThreads =
+    ConfigMgr::lookUp<uint32_t>("offload.threads", 4, "threads of the default offload pool");
+
+static ConfigArg<uint32_t>::ptr g_offloadQueueLimit =
+    ConfigMgr::lookUp<uint32_t>("offload.queue_limit", 1024,
+                                "jobs waiting for a thread of the default offload pool, "
+                                "further callers park until one is taken");
+
+// pool whose job the current thread runs
+static thread_local OffloadPool* t_pool = nullptr;
+
+// one call of run(), lives on the stack of the caller
+struct OffloadPool::Job {
+    Callable fn;
+    std::exception_ptr error;
+
+    Spinlock mutex;
+    bool done = false;
+    FiberWaitQueue waiters;
+
+    void execute() {
+        try {
+            fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+
+    // the caller may return and free the job as soon as the lock is released
+    void finish() {
+        FiberWaitQueue::Waiter* w = nullptr;
+        {
+            Spinlock::Lock lock(mutex);
+            done = true;
+            w = waiters.pop();
+        }
+        if (w) {
+            w->wake();
+        }
+    }
+};
+
+OffloadPool::OffloadPool(size_t threads, size_t queueLimit, const std::string& name)
+    : m_name{ name },
+    m_queueLimit{ queueLimit ? queueLimit : 1 },
+    m_slots{ m_queueLimit } {
+    SERVER_ASSERT(threads > 0);
+    m_threads.resize(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads[i] = std::make_shared<Thread>([this]() { work(); }, m_name + "_" + std::to_string(i));
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    stop();
+}
+
+void OffloadPool::run(Callable fn) {
+    Job job;
+    job.fn = std::move(fn);
+
+    // a job offloading again would wait for a slot its own thread holds
+    if (t_pool == this) {
+        job.execute();
+    } else {
+        // a pool thread writes the job while the caller is parked
+        SERVER_ASSERT_INFO(!Fiber::onSharedStack(), "shared-stack coroutine cannot offload");
+        m_slots.wait();
+        if (!push(&job)) {
+            m_slots.notify();
+            job.execute();
+        } else {
+            Spinlock::Lock lock(job.mutex);
+            if (!job.done) {
+                job.waiters.park(lock);
+            }
+        }
+    }
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+bool OffloadPool::push(Job* job) {
+    {
+        Mutex::Lock lock(m_mutex);
+        if (m_stopping) {
+            return false;
+        }
+        m_jobs.push_back(job);
+    }
+    m_ready.notify();
+    return true;
+}
+
+void OffloadPool::stop() {
+    std::vector<Thread::ptr> threads;
+    {
+        Mutex::Lock lock(m_mutex);
+        if (m_stopping) {
+            return;
+        }
+        m_stopping = true;
+        threads = m_threads;
+    }
+
+    // threads leave once the queue is drained
+    for (size_t i = 0; i < threads.size(); ++i) {
+        m_ready.notify();
+    }
+    for (auto& t : threads) {
+        t->join();
+    }
+    SERVER_LOG_DEBUG(g_logger) << "offload pool " << m_name << " stopped";
+}
+
+size_t OffloadPool::getQueued() {
+    Mutex::Lock lock(m_mutex);
+    return m_jobs.size();
+}
+
+void OffloadPool::work() {
+    t_pool = this;
+    while (true) {
+        m_ready.wait();
+
+        Job* job = nullptr;
+        {
+            Mutex::Lock lock(m_mutex);
+            if (m_jobs.empty()) {
+                if (m_stopping) {
+                    break;
+                }
+                continue;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        m_slots.notify();
+        job->execute();
+        job->finish();
+    }
+    t_pool = nullptr;
+}
+
+OffloadPool* OffloadPool::getDefault() {
+    static OffloadPool pool(std::max<uint32_t>(g_offloadThreads->getValue(), 1),
+                            g_offloadQueueLimit->getValue(), "offload");
+    return &pool;
+}
+
+}
@@ -0,0 +1,95 @@
+#ifndef __SERVER_OFFLOAD_HPP__
+#define __SERVER_OFFLOAD_HPP__
+
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "callable.hpp"
+#include "fiber_sync.hpp"
+#include "mutex.hpp"
+#include "thread.hpp"
+
+namespace Server {
+
+// threads running blocking calls (getaddrinfo, fsync, file io...) for
+// coroutines, the caller parks until its job is done and is then scheduled
+// again on its own scheduler, its worker thread keeps running other tasks.
+// at most queueLimit jobs wait for a thread, further callers park until one
+// is taken
+class OffloadPool {
+public:
+    using ptr = std::shared_ptr<OffloadPool>;
+
+    OffloadPool(size_t threads, size_t queueLimit, const std::string& name = "offload");
+
+    ~OffloadPool();
+
+    // run fn on a pool thread and return what it returns, exceptions are
+    // rethrown in the caller
+    template<typename Fn>
+    auto call(Fn&& fn) -> std::invoke_result_t<Fn&> {
+        using R = std::invoke_result_t<Fn&>;
+        if constexpr (std::is_void_v<R>) {
+            run([&fn]() { fn(); });
+        } else {
+            std::optional<R> result;
+            run([&fn, &result]() { result.emplace(fn()); });
+            return std::move(*result);
+        }
+    }
+
+    // run fn on a pool thread, park the caller until it returns. the job
+    // lives on the caller's stack, a shared-stack coroutine cannot call it
+    void run(Callable fn);
+
+    // finish the queued jobs and join the threads, later calls run inline
+    void stop();
+
+    size_t getThreadCount() const { return m_threads.size(); }
+    size_t getQueueLimit() const { return m_queueLimit; }
+
+    // jobs waiting for a thread
+    size_t getQueued();
+
+    // pool sized by offload.threads and offload.queue_limit, made on first use
+    static OffloadPool* getDefault();
+
+private:
+    struct Job;
+
+    void work();
+
+    // hand a job to the threads, false if the pool is stopped
+    bool push(Job* job);
+
+private:
+    std::string m_name;
+    size_t m_queueLimit;
+
+    Mutex m_mutex;
+    std::deque<Job*> m_jobs;
+    bool m_stopping = false;
+
+    // one post per queued job, and one per thread on stop
+    Semaphore m_ready;
+
+    // free queue slots, callers park here when the queue is full
+    FiberSemaphore m_slots;
+
+    std::vector<Thread::ptr> m_threads;
+};
+
+// run fn on the default offload pool, see OffloadPool::call
+template<typename Fn>
+auto offload(Fn&& fn) -> std::invoke_result_t<Fn&> {
+    return OffloadPool::getDefault()->call(std::forward<Fn>(fn));
+}
+
+}
+
+#endif
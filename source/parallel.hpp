@@ -0,0 +1,151 @@
+#ifndef __SERVER_PARALLEL_HPP__
+#define __SERVER_PARALLEL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <exception>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#include "fiber_sync.hpp"
+#include "macro.hpp"
+#include "scheduler.hpp"
+
+namespace Server {
+
+namespace detail {
+
+// state shared by the tasks of one parallelFor or parallelReduce call
+struct ParallelJoin {
+    WaitGroup wg{ 1 };
+
+    // first exception thrown by a chunk, the others stop taking chunks
+    std::atomic<bool> failed{ false };
+    std::exception_ptr error;
+
+    void fail() {
+        if (!failed.exchange(true)) {
+            error = std::current_exception();
+        }
+    }
+};
+
+// run chunks [begin, end) with body, the upper half of what is left goes
+// to another task whenever the scheduler has an idle worker to take it. a
+// busy pool thus runs big sequential pieces, an idle one splits finely
+template<typename Body>
+void runChunks(Scheduler* sc, size_t begin, size_t end, const Body& body, ParallelJoin* join) {
+    try {
+        while (begin < end && !join->failed.load(std::memory_order_relaxed)) {
+            if (end - begin > 1 && sc->getIdleThreadCount() > 0) {
+                size_t mid = begin + (end - begin) / 2;
+                join->wg.add(1);
+                sc->schedule([sc, mid, end, &body, join]() {
+                    runChunks(sc, mid, end, body, join);
+                });
+                end = mid;
+                continue;
+            }
+
+            body(begin);
+            ++begin;
+        }
+    } catch (...) {
+        join->fail();
+    }
+    // the last touch of join, the caller may return and free it from here on
+    join->wg.done();
+}
+
+// run chunks [0, count) on sc and wait for them without blocking the
+// thread when called from a coroutine, rethrow the first exception
+template<typename Body>
+void forkJoin(Scheduler* sc, size_t count, const Body& body) {
+    // the tasks of other workers reach body and join on the caller's stack
+    SERVER_ASSERT_INFO(!Fiber::onSharedStack(), "parallelFor cannot run in a shared-stack coroutine");
+    ParallelJoin join;
+    if (Scheduler::getThis() == sc) {
+        // a worker of sc takes the first pieces itself
+        runChunks(sc, 0, count, body, &join);
+    } else {
+        sc->schedule([sc, count, &body, &join]() { runChunks(sc, 0, count, body, &join); });
+    }
+
+    join.wg.wait();
+    if (join.error) {
+        std::rethrow_exception(join.error);
+    }
+}
+
+// chunk size when none is given, several chunks per thread of sc
+inline size_t autoGrain(Scheduler* sc, size_t n) {
+    return std::max<size_t>(n / (8 * (sc->getThreadCount() + 1)), 1);
+}
+
+}
+
+// call fn(i) for every i in [begin, end) on the workers of sc, the range is
+// cut into chunks of grain indices (chosen from the pool size if 0) which
+// are only handed out as workers go idle
+template<std::integral Index, typename Fn>
+void parallelFor(Scheduler* sc, Index begin, Index end, Fn&& fn, size_t grain = 0) {
+    if (begin >= end) {
+        return;
+    }
+
+    size_t n = end - begin;
+    grain = grain ? grain : detail::autoGrain(sc, n);
+    auto body = [&](size_t chunk) {
+        Index first = begin + static_cast<Index>(chunk * grain);
+        Index last = static_cast<Index>(first + std::min(grain, static_cast<size_t>(end - first)));
+        for (Index i = first; i < last; ++i) {
+            fn(i);
+        }
+    };
+    detail::forkJoin(sc, (n + grain - 1) / grain, body);
+}
+
+// call fn(element) for every element of a random access range, see above
+template<std::ranges::random_access_range Range, typename Fn>
+void parallelFor(Scheduler* sc, Range&& range, Fn&& fn, size_t grain = 0) {
+    auto first = std::ranges::begin(range);
+    parallelFor(sc, static_cast<size_t>(0), static_cast<size_t>(std::ranges::size(range)),
+                [&](size_t i) { fn(first[i]); }, grain);
+}
+
+// fold map(i) over [begin, end) with reduce on the workers of sc. each
+// chunk folds its indices in order starting from identity, the chunks are
+// then folded in order, so reduce has to be associative but not commutative
+template<std::integral Index, typename T, typename Map, typename Reduce>
+T parallelReduce(Scheduler* sc, Index begin, Index end, T identity, Map&& map, Reduce&& reduce, size_t grain = 0) {
+    if (begin >= end) {
+        return identity;
+    }
+
+    size_t n = end - begin;
+    grain = grain ? grain : detail::autoGrain(sc, n);
+    size_t chunks = (n + grain - 1) / grain;
+    std::vector<T> partials(chunks, identity);
+    auto body = [&](size_t chunk) {
+        Index first = begin + static_cast<Index>(chunk * grain);
+        Index last = static_cast<Index>(first + std::min(grain, static_cast<size_t>(end - first)));
+        T acc = identity;
+        for (Index i = first; i < last; ++i) {
+            acc = reduce(std::move(acc), map(i));
+        }
+        partials[chunk] = std::move(acc);
+    };
+    detail::forkJoin(sc, chunks, body);
+
+    T result = std::move(identity);
+    for (auto& i : partials) {
+        result = reduce(std::move(result), std::move(i));
+    }
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,422 @@
+#include "poller.hpp"
+#include "log.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Server {
+
+static Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+Poller::ptr Poller::create(const std::string& name) {
+    if (name == "io_uring" || name == "auto") {
+        Poller::ptr poller = IoUringPoller::create();
+        if (poller) {
+            return poller;
+        }
+
+        if (name == "io_uring") {
+            SERVER_LOG_WARN(g_logger) << "io_uring unavailable (" << errno << ") ("
+                                    << strerror(errno) << "), falling back to epoll";
+        }
+    } else if (name != "epoll") {
+        SERVER_LOG_WARN(g_logger) << "unknown poller " << name << ", using epoll";
+    }
+    return std::make_shared<EpollPoller>();
+}
+
+EpollPoller::EpollPoller() {
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    SERVER_ASSERT(m_epfd >= 0);
+
+    m_notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SERVER_ASSERT(m_notifyFd >= 0);
+
+    // no data marks the notify eventfd
+    bool ok = control(EPOLL_CTL_ADD, m_notifyFd, EPOLLIN, nullptr);
+    SERVER_ASSERT(ok);
+}
+
+EpollPoller::~EpollPoller() {
+    close(m_epfd);
+    close(m_notifyFd);
+}
+
+bool EpollPoller::control(int op, int fd, uint32_t events, void* data) {
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLET | events;
+    event.data.ptr = data;
+    return !epoll_ctl(m_epfd, op, fd, &event);
+}
+
+bool EpollPoller::add(int fd, uint32_t events, void* data) {
+    return control(EPOLL_CTL_ADD, fd, events, data);
+}
+
+bool EpollPoller::modify(int fd, uint32_t events, void* data) {
+    return control(EPOLL_CTL_MOD, fd, events, data);
+}
+
+bool EpollPoller::remove(int fd, void* data) {
+    return control(EPOLL_CTL_DEL, fd, 0, data);
+}
+
+int EpollPoller::wait(Event* events, int max, int timeoutMs) {
+    // one thread waits at a time, the buffer is reused
+    if (static_cast<int>(m_events.size()) < max) {
+        m_events.resize(max);
+    }
+
+    int ret = 0;
+    do {
+        ret = epoll_wait(m_epfd, m_events.data(), max, timeoutMs);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        SERVER_LOG_ERROR(g_logger) << "epoll_wait (" << m_epfd << "):" << ret
+                                << " (" << errno << ") (" << strerror(errno) << ")";
+        return 0;
+    }
+
+    for (int i = 0; i < ret; ++i) {
+        events[i] = Event();
+        events[i].data = m_events[i].data.ptr;
+        if (!events[i].data) {
+            // one read resets the counter of every notify so far
+            uint64_t count;
+            while (read(m_notifyFd, &count, sizeof(count)) < 0 && errno == EINTR);
+            continue;
+        }
+        events[i].events = m_events[i].events & (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP);
+    }
+    return ret;
+}
+
+void EpollPoller::notify() {
+    uint64_t one = 1;
+    int ret = write(m_notifyFd, &one, sizeof(one));
+    SERVER_ASSERT(ret == sizeof(one));
+}
+
+// user data of the entries that are not requests: a notify, a completion
+// nobody waits for, and poll requests tagged with their fd and generation
+static const uint64_t WAKE_DATA = 0;
+static const uint64_t IGNORE_DATA = 1;
+static const uint64_t POLL_TAG = 1ULL << 63;
+
+static uint64_t pollData(int fd, uint32_t generation) {
+    return POLL_TAG | (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+std::shared_ptr<IoUringPoller> IoUringPoller::create(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    std::shared_ptr<IoUringPoller> poller(new IoUringPoller);
+    poller->m_fd = fd;
+
+    // timed waits need EXT_ARG (5.11), both rings come from one mapping
+    uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        errno = ENOSYS;
+        return nullptr;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    poller->m_ringSize = std::max(sqSize, cqSize);
+    void* ring = mmap(nullptr, poller->m_ringSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        return nullptr;
+    }
+    poller->m_ring = ring;
+
+    poller->m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, poller->m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    poller->m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* base = static_cast<char*>(ring);
+    poller->m_sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    poller->m_sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    poller->m_sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    poller->m_sqEntries = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_entries);
+    poller->m_sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+
+    poller->m_cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    poller->m_cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    poller->m_cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    poller->m_cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    poller->m_tail = *poller->m_sqTail;
+    return poller;
+}
+
+IoUringPoller::~IoUringPoller() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_ring) {
+        munmap(m_ring, m_ringSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+int IoUringPoller::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+    return syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+io_uring_sqe* IoUringPoller::getSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_tail - head >= m_sqEntries) {
+        // ring full, the kernel has to take what is queued first
+        enter(m_tail - head, 0, 0, nullptr, 0);
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_tail - head >= m_sqEntries) {
+            return nullptr;
+        }
+    }
+
+    unsigned index = m_tail & m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    m_sqArray[index] = index;
+    return sqe;
+}
+
+void IoUringPoller::pushSqe() {
+    ++m_tail;
+    __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+}
+
+void IoUringPoller::flush() {
+    // otherwise the next wait() submits the entries with its own syscall
+    if (!m_waiting) {
+        return;
+    }
+
+    unsigned pending = m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (pending) {
+        while (enter(pending, 0, 0, nullptr, 0) < 0 && errno == EINTR);
+    }
+}
+
+void IoUringPoller::disarm(FdState& state, int fd) {
+    uint64_t armed = pollData(fd, state.generation);
+    // a completion of the old request is stale from here on
+    state.armed = false;
+    state.generation = (state.generation + 1) & 0x7fffffff;
+
+    io_uring_sqe* sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = armed;
+        sqe->user_data = IGNORE_DATA;
+        pushSqe();
+    }
+}
+
+bool IoUringPoller::arm(int fd, uint32_t events, void* data) {
+    if (fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+
+    Mutex::Lock lock(m_mutex);
+    if (static_cast<size_t>(fd) >= m_fds.size()) {
+        m_fds.resize(std::max<size_t>(fd + 1, m_fds.size() * 2));
+    }
+
+    FdState& state = m_fds[fd];
+    if (state.armed) {
+        disarm(state, fd);
+    }
+
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        errno = EBUSY;
+        return false;
+    }
+
+    state.generation = (state.generation + 1) & 0x7fffffff;
+    state.data = data;
+    state.armed = true;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = pollData(fd, state.generation);
+    pushSqe();
+    flush();
+    return true;
+}
+
+bool IoUringPoller::add(int fd, uint32_t events, void* data) {
+    return arm(fd, events, data);
+}
+
+bool IoUringPoller::modify(int fd, uint32_t events, void* data) {
+    return arm(fd, events, data);
+}
+
+bool IoUringPoller::remove(int fd, void* data) {
+    Mutex::Lock lock(m_mutex);
+    // a request that fired is gone already, nothing to remove then
+    if (fd >= 0 && static_cast<size_t>(fd) < m_fds.size() && m_fds[fd].armed) {
+        disarm(m_fds[fd], fd);
+        flush();
+    }
+    return true;
+}
+
+bool IoUringPoller::submit(const Request& req, void* data) {
+    uint64_t userData = reinterpret_cast<uint64_t>(data);
+    SERVER_ASSERT(userData > IGNORE_DATA && !(userData & POLL_TAG));
+
+    Mutex::Lock lock(m_mutex);
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+
+    switch (req.op) {
+        case Op::RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = reinterpret_cast<uint64_t>(req.buf);
+            sqe->len = req.len;
+            sqe->msg_flags = req.flags;
+            break;
+        case Op::SEND:
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = reinterpret_cast<uint64_t>(req.buf);
+            sqe->len = req.len;
+            sqe->msg_flags = req.flags;
+            break;
+        case Op::ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->addr = reinterpret_cast<uint64_t>(req.addr);
+            sqe->addr2 = reinterpret_cast<uint64_t>(req.addrlen);
+            sqe->accept_flags = req.flags;
+            break;
+    }
+    sqe->fd = req.fd;
+    sqe->user_data = userData;
+    pushSqe();
+    flush();
+    return true;
+}
+
+bool IoUringPoller::cancel(void* data) {
+    Mutex::Lock lock(m_mutex);
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+
+    // queued behind the request it cancels, the kernel has seen it by then
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->user_data = IGNORE_DATA;
+    pushSqe();
+    flush();
+    return true;
+}
+
+void IoUringPoller::notify() {
+    Mutex::Lock lock(m_mutex);
+    io_uring_sqe* sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = WAKE_DATA;
+        pushSqe();
+    }
+    flush();
+}
+
+int IoUringPoller::wait(Event* events, int max, int timeoutMs) {
+    Mutex::Lock lock(m_mutex);
+    unsigned pending = m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    bool ready = *m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    // entries queued from now on are submitted by their own thread
+    m_waiting = !ready;
+    lock.unlock();
+
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+
+    if (!ready) {
+        // submit what is queued and sleep for the first completion in one call
+        int ret = enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+            SERVER_LOG_ERROR(g_logger) << "io_uring_enter (" << m_fd << "):" << ret
+                                    << " (" << errno << ") (" << strerror(errno) << ")";
+        }
+    } else if (pending) {
+        enter(pending, 0, 0, nullptr, 0);
+    }
+
+    lock.lock();
+    m_waiting = false;
+
+    int n = 0;
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail && n < max; ++head) {
+        const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+        if (cqe.user_data == WAKE_DATA) {
+            events[n++] = Event();
+        } else if (cqe.user_data == IGNORE_DATA) {
+            continue;
+        } else if (cqe.user_data & POLL_TAG) {
+            size_t fd = static_cast<uint32_t>(cqe.user_data);
+            uint32_t generation = (cqe.user_data >> 32) & 0x7fffffff;
+            if (fd >= m_fds.size() || !m_fds[fd].armed || m_fds[fd].generation != generation) {
+                continue;
+            }
+
+            // the request is one-shot, modify() arms the next
+            m_fds[fd].armed = false;
+            Event& e = events[n++];
+            e = Event();
+            e.data = m_fds[fd].data;
+            e.events = cqe.res < 0 ? POLLERR : cqe.res;
+        } else {
+            Event& e = events[n++];
+            e = Event();
+            e.data = reinterpret_cast<void*>(cqe.user_data);
+            e.completed = true;
+            e.result = cqe.res;
+        }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+}
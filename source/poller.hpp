@@ -0,0 +1,194 @@
+#ifndef __SERVER_POLLER_HPP__
+#define __SERVER_POLLER_HPP__
+
+#include <memory>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "mutex.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace Server {
+
+// readiness backend of IOManager. interest is one-shot: once an fd is
+// reported, the caller registers what it still waits for with modify() or
+// drops the fd with remove(). event masks use the poll(2) bits, POLLIN and
+// POLLOUT to wait for, POLLERR and POLLHUP are always reported
+class Poller {
+public:
+    using ptr = std::shared_ptr<Poller>;
+
+    // operations a backend may run itself instead of reporting readiness
+    enum class Op {
+        RECV,
+        SEND,
+        ACCEPT
+    };
+
+    struct Request {
+        Op op;
+        int fd;
+        void* buf = nullptr;
+        size_t len = 0;
+        int flags = 0;
+
+        // accept only
+        sockaddr* addr = nullptr;
+        socklen_t* addrlen = nullptr;
+    };
+
+    // one result of wait()
+    struct Event {
+        // data given with the fd or the request, nullptr for a notify()
+        void* data = nullptr;
+
+        // ready poll bits of an fd
+        uint32_t events = 0;
+
+        // a completed request and what its syscall returned, -errno on error
+        bool completed = false;
+        int result = 0;
+    };
+
+    virtual ~Poller() {}
+
+    virtual const char* getName() const = 0;
+
+    // start waiting for events on fd, data comes back with them. false
+    // with errno set on error
+    virtual bool add(int fd, uint32_t events, void* data) = 0;
+
+    // replace the events fd waits for
+    virtual bool modify(int fd, uint32_t events, void* data) = 0;
+
+    // stop waiting on fd
+    virtual bool remove(int fd, void* data) = 0;
+
+    // run req asynchronously, its result comes back from wait() with data.
+    // false if the backend cannot, the caller then waits for readiness
+    virtual bool submit(const Request& req, void* data) { return false; }
+
+    // abort a request given to submit(), it completes with -ECANCELED
+    // unless it finished already
+    virtual bool cancel(void* data) { return false; }
+
+    // wait up to timeoutMs (-1 forever) and fill at most max events, a
+    // pending notify() ends the wait early
+    virtual int wait(Event* events, int max, int timeoutMs) = 0;
+
+    // interrupt wait() from another thread, reported as an event without data
+    virtual void notify() = 0;
+
+    // backend named epoll, io_uring or auto (io_uring when the kernel
+    // allows it), io_uring falls back to epoll when it cannot be set up
+    static Poller::ptr create(const std::string& name);
+};
+
+// edge-triggered epoll, notify() writes an eventfd
+class EpollPoller : public Poller {
+public:
+    EpollPoller();
+    ~EpollPoller();
+
+    const char* getName() const override { return "epoll"; }
+
+    bool add(int fd, uint32_t events, void* data) override;
+    bool modify(int fd, uint32_t events, void* data) override;
+    bool remove(int fd, void* data) override;
+    int wait(Event* events, int max, int timeoutMs) override;
+    void notify() override;
+
+private:
+    bool control(int op, int fd, uint32_t events, void* data);
+
+private:
+    int m_epfd = -1;
+    int m_notifyFd = -1;
+    std::vector<epoll_event> m_events;
+};
+
+// io_uring through the raw syscalls: one-shot poll requests for readiness,
+// and recv/send/accept run by the kernel. requests queued by add(), modify()
+// or submit() go to the kernel with the next wait(), at once only when a
+// thread already waits, so registrations between two waits cost no syscall
+class IoUringPoller : public Poller {
+public:
+    // nullptr with errno set when the kernel lacks io_uring or the features used
+    static std::shared_ptr<IoUringPoller> create(unsigned entries = 1024);
+
+    ~IoUringPoller();
+
+    const char* getName() const override { return "io_uring"; }
+
+    bool add(int fd, uint32_t events, void* data) override;
+    bool modify(int fd, uint32_t events, void* data) override;
+    bool remove(int fd, void* data) override;
+    bool submit(const Request& req, void* data) override;
+    bool cancel(void* data) override;
+    int wait(Event* events, int max, int timeoutMs) override;
+    void notify() override;
+
+private:
+    IoUringPoller() = default;
+
+    // poll request armed for an fd, its generation tells stale completions apart
+    struct FdState {
+        void* data = nullptr;
+        uint32_t generation = 0;
+        bool armed = false;
+    };
+
+    // free submission entry, nullptr if the kernel does not take any
+    io_uring_sqe* getSqe();
+
+    // publish the entry filled from getSqe()
+    void pushSqe();
+
+    // hand queued entries to the kernel if a thread sleeps in wait()
+    void flush();
+
+    // queue a poll request for fd, replacing the armed one
+    bool arm(int fd, uint32_t events, void* data);
+
+    // queue the removal of the armed poll request of fd
+    void disarm(FdState& state, int fd);
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize);
+
+private:
+    int m_fd = -1;
+
+    // rings shared with the kernel
+    void* m_ring = nullptr;
+    size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned* m_sqArray = nullptr;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    // guards the rings and the fd table, held across submitting syscalls
+    Mutex m_mutex;
+    unsigned m_tail = 0;
+
+    // a thread is blocked in io_uring_enter waiting for completions
+    bool m_waiting = false;
+
+    std::vector<FdState> m_fds;
+};
+
+}
+
+#endif
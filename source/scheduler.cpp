@@ -1,10 +1,266 @@
 #include "scheduler.hpp"
+#include "config.hpp"
 #include "log.hpp"
 #include "macro.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <execinfo.h>
+#include <mutex>
+#include <set>
+#include <signal.h>
+#include <string.h>
 
 namespace Server {
 static Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
+static ConfigArg<uint32_t>::ptr g_prewarmFibers =
+    ConfigMgr::lookUp<uint32_t>("scheduler.prewarm_fibers", 0, "coroutines cached by each worker on start");
+
+static ConfigArg<uint32_t>::ptr g_spinCount =
+    ConfigMgr::lookUp<uint32_t>("scheduler.spin_count", 1000, "rounds an idle worker spins before it parks");
+
+static ConfigArg<uint32_t>::ptr g_elasticQueueWait =
+    ConfigMgr::lookUp<uint32_t>("scheduler.elastic.queue_wait_ms", 5,
+                                "tasks queued this long with no idle worker add a thread to an elastic pool");
+
+static ConfigArg<uint32_t>::ptr g_elasticBlocked =
+    ConfigMgr::lookUp<uint32_t>("scheduler.elastic.blocked_ms", 20,
+                                "a worker running one task this long counts as blocked and is replaced");
+
+static ConfigArg<uint32_t>::ptr g_elasticIdleTimeout =
+    ConfigMgr::lookUp<uint32_t>("scheduler.elastic.idle_timeout_ms", 10000,
+                                "a thread of an elastic pool idle this long retires");
+
+static ConfigArg<uint32_t>::ptr g_watchdogBudget =
+    ConfigMgr::lookUp<uint32_t>("scheduler.watchdog.budget_ms", 0,
+                                "a coroutine running this long without yielding is reported and asked "
+                                "to yield at Fiber::maybeYield(), 0 turns the watchdog off");
+
+static ConfigArg<uint32_t>::ptr g_statsSample =
+    ConfigMgr::lookUp<uint32_t>("scheduler.stats_sample", 16,
+                                "1 in this many tasks is timed for the scheduler latency histograms, "
+                                "0 turns the timing off");
+
+static std::atomic<uint32_t> s_spinCount{ 0 };
+static std::atomic<uint32_t> s_statsSample{ 0 };
+static std::atomic<uint32_t> s_idleTimeout{ 0 };
+static std::atomic<uint32_t> s_sliceBudget{ 0 };
+
+// SIGURG action installed before the watchdog's, out-of-band data still reaches it
+static struct sigaction s_prevTraceAction;
+
+struct SchedulerIniter {
+    SchedulerIniter() {
+        s_spinCount = g_spinCount->getValue();
+        g_spinCount->addListener([](const uint32_t& oldValue, const uint32_t& newValue) {
+            s_spinCount = newValue;
+        });
+
+        s_idleTimeout = g_elasticIdleTimeout->getValue();
+        g_elasticIdleTimeout->addListener([](const uint32_t& oldValue, const uint32_t& newValue) {
+            s_idleTimeout = newValue;
+        });
+
+        s_statsSample = g_statsSample->getValue();
+        g_statsSample->addListener([](const uint32_t& oldValue, const uint32_t& newValue) {
+            s_statsSample = newValue;
+        });
+
+        s_sliceBudget = g_watchdogBudget->getValue();
+        g_watchdogBudget->addListener([](const uint32_t& oldValue, const uint32_t& newValue) {
+            s_sliceBudget = newValue;
+        });
+    }
+};
+
+static SchedulerIniter __scheduler_init;
+
+// hint to the cpu that this is a spin-wait loop
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// placement of the worker threads of one scheduler, e.g.
+//   scheduler:
+//     affinity:
+//       io: { cpus: [0, 1], isolate: true }
+//       compute: { numa_nodes: [0], physical_cores: true }
+struct AffinityDefine {
+    // worker i is pinned to cpus[i % n]
+    std::vector<int> cpus;
+
+    // workers are spread over these nodes, pinned to the cpus of their node
+    std::vector<int> numaNodes;
+
+    // one worker per physical core, pinned to the hardware threads of it
+    bool physicalCores = false;
+
+    // the cpus of this scheduler are taken out of the ones other schedulers
+    // derive from numa_nodes and physical_cores
+    bool isolate = false;
+
+    bool operator==(const AffinityDefine& oth) const {
+        return cpus == oth.cpus
+            && numaNodes == oth.numaNodes
+            && physicalCores == oth.physicalCores
+            && isolate == oth.isolate;
+    }
+};
+
+// fully specialized template for conversion from string to AffinityDefine
+template<>
+class LexicalCast<std::string, AffinityDefine> {
+public:
+    AffinityDefine operator()(const std::string& v){
+        YAML::Node node = YAML::Load(v);
+
+        AffinityDefine ad;
+        if (node["cpus"].IsDefined()) {
+            ad.cpus = node["cpus"].as<std::vector<int>>();
+        }
+
+        if (node["numa_nodes"].IsDefined()) {
+            ad.numaNodes = node["numa_nodes"].as<std::vector<int>>();
+        }
+
+        if (node["physical_cores"].IsDefined()) {
+            ad.physicalCores = node["physical_cores"].as<bool>();
+        }
+
+        if (node["isolate"].IsDefined()) {
+            ad.isolate = node["isolate"].as<bool>();
+        }
+        return ad;
+    };
+};
+
+// fully specialized template for conversion from AffinityDefine to string
+template<>
+class LexicalCast<AffinityDefine, std::string> {
+public:
+    std::string operator()(const AffinityDefine& ad){
+        YAML::Node node(YAML::NodeType::Map);
+        for (int cpu : ad.cpus) {
+            node["cpus"].push_back(cpu);
+        }
+
+        for (int n : ad.numaNodes) {
+            node["numa_nodes"].push_back(n);
+        }
+
+        node["physical_cores"] = ad.physicalCores;
+        node["isolate"] = ad.isolate;
+
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    };
+};
+
+static ConfigArg<std::map<std::string, AffinityDefine>>::ptr g_affinity =
+    ConfigMgr::lookUp("scheduler.affinity", std::map<std::string, AffinityDefine>(),
+                      "cpu placement of worker threads by scheduler name");
+
+// cpus an entry claims when other schedulers are kept off it
+static std::vector<int> claimedCpus(const AffinityDefine& ad) {
+    if (!ad.cpus.empty()) {
+        return ad.cpus;
+    }
+
+    std::vector<int> cpus;
+    for (int node : ad.numaNodes) {
+        std::vector<int> nodeCpus = getNodeCpus(node);
+        cpus.insert(cpus.end(), nodeCpus.begin(), nodeCpus.end());
+    }
+    return cpus;
+}
+
+// cpus each of count workers of scheduler name is pinned to, empty sets
+// leave a worker unpinned
+static std::vector<std::vector<int>> planAffinity(const std::string& name, size_t count) {
+    std::vector<std::vector<int>> plan(count);
+    auto defines = g_affinity->getValue();
+    auto it = defines.find(name);
+    if (it == defines.end()) {
+        return plan;
+    }
+
+    const AffinityDefine& ad = it->second;
+    if (!ad.cpus.empty()) {
+        for (size_t i = 0; i < count; ++i) {
+            plan[i].push_back(ad.cpus[i % ad.cpus.size()]);
+        }
+        return plan;
+    }
+
+    // cpus isolated by other schedulers
+    std::set<int> reserved;
+    for (auto& i : defines) {
+        if (i.first != name && i.second.isolate) {
+            std::vector<int> cpus = claimedCpus(i.second);
+            reserved.insert(cpus.begin(), cpus.end());
+        }
+    }
+
+    auto available = [&](std::vector<int> cpus) {
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                                  [&](int cpu) { return reserved.count(cpu) > 0; }),
+                   cpus.end());
+        return cpus;
+    };
+
+    // candidate cpu groups, a worker is pinned to one group
+    std::vector<std::vector<int>> groups;
+    if (ad.physicalCores) {
+        std::vector<int> cpus;
+        if (ad.numaNodes.empty()) {
+            cpus = available(getOnlineCpus());
+        } else {
+            cpus = available(claimedCpus(ad));
+        }
+
+        std::set<int> seen;
+        for (int cpu : cpus) {
+            if (seen.count(cpu)) {
+                continue;
+            }
+
+            std::vector<int> core = getCoreSiblings(cpu);
+            seen.insert(core.begin(), core.end());
+            core = available(core);
+            if (!core.empty()) {
+                groups.push_back(core);
+            }
+        }
+    } else if (!ad.numaNodes.empty()) {
+        for (int node : ad.numaNodes) {
+            std::vector<int> cpus = available(getNodeCpus(node));
+            if (cpus.empty()) {
+                SERVER_LOG_ERROR(g_logger) << "scheduler " << name << ": numa node " << node << " has no usable cpu";
+                continue;
+            }
+            groups.push_back(cpus);
+        }
+    } else if (!reserved.empty()) {
+        groups.push_back(available(getOnlineCpus()));
+    }
+
+    if (groups.empty() || groups[0].empty()) {
+        return plan;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        plan[i] = groups[i % groups.size()];
+    }
+    return plan;
+}
+
 // t_scheduler and t_fiber can be retrieved by client using Scheduler::getThis(), Scheduler::getMainFiber()
 // pointer to scheduler
 static thread_local Scheduler* t_scheduler{ nullptr };
@@ -12,6 +268,148 @@ static thread_local Scheduler* t_scheduler{ nullptr };
 // pointer to the coroutine that is currently working on thread
 static thread_local Fiber* t_fiber{ nullptr };
 
+thread_local Scheduler::Worker* Scheduler::t_worker{ nullptr };
+
+// tasks queued by current thread, picks the ones that are timed
+static thread_local uint32_t t_sampleTick{ 0 };
+
+// time task if it is one of the sampled ones
+static inline uint64_t sampleQueuedTime() {
+    uint32_t sample = s_statsSample.load(std::memory_order_relaxed);
+    return sample && ++t_sampleTick % sample == 0 ? getCurrentUS() : 0;
+}
+
+struct Scheduler::Worker {
+    explicit Worker(Scheduler* s, uint64_t id): scheduler{ s }, seed{ id * 0x9e3779b97f4a7c15ULL + 1 } {}
+
+    Scheduler* scheduler;
+
+    // tasks submitted by this worker, taken by idle workers too
+    WorkStealingQueue<FiberAndThread*> tasks;
+
+    // tasks pinned to the thread of this worker
+    Spinlock mailboxMutex;
+    FiberAndThread* mailboxHead = nullptr;
+    FiberAndThread* mailboxTail = nullptr;
+    std::atomic<size_t> mailboxSize{ 0 };
+
+    // emptied task nodes, only touched by the owner thread
+    std::vector<FiberAndThread*> freeTasks;
+
+    // thread running this worker, 0 until it starts
+    std::atomic<int> threadId{ 0 };
+
+    // tasks started plus tasks finished, odd while one runs, the supervisor
+    // spots a blocked worker by it standing still
+    std::atomic<uint64_t> runs{ 0 };
+
+    // set under mailboxMutex when the thread retires, mail goes elsewhere then
+    bool closed = false;
+
+    // thread has left run() for good and can be joined
+    std::atomic<bool> retired{ false };
+
+    // when the running task was swapped in in microseconds, 0 between tasks,
+    // only kept while the watchdog is on
+    std::atomic<uint64_t> sliceStart{ 0 };
+    std::atomic<uint64_t> sliceFiber{ 0 };
+
+    // telemetry shard of this worker, only written by its thread
+    std::atomic<uint64_t> tasksRun{ 0 };
+    std::atomic<uint64_t> idles{ 0 };
+    std::atomic<uint64_t> parks{ 0 };
+    std::atomic<uint64_t> steals{ 0 };
+    std::atomic<uint64_t> wakeups{ 0 };
+    std::atomic<uint64_t> notifies{ 0 };
+    Log2Histogram queueLatency;
+    Log2Histogram sliceTime;
+
+    // raised by the watchdog, the coroutine yields at Fiber::maybeYield()
+    std::atomic<bool> preempt{ false };
+
+    // slice the watchdog reported last, only touched by the supervisor
+    uint64_t reportedSlice = 0;
+
+    // backtrace taken by onTraceSignal() on request of the watchdog
+    static const int TRACE_DEPTH = 32;
+    pthread_t pthread = 0;
+    std::atomic<bool> traceRequested{ false };
+    std::atomic<bool> traceReady{ false };
+    void* trace[TRACE_DEPTH];
+    int traceDepth = 0;
+
+    enum SleepState {
+        RUNNING,
+        PARKED,     // blocked on parker
+        POLLING     // blocked in the poller of the scheduler
+    };
+
+    std::atomic<int> sleepState{ RUNNING };
+    Parker parker;
+
+    // tasks taken so far, paces the injection queue checks
+    uint32_t tick = 0;
+
+    // xorshift state choosing the victim to steal from
+    uint64_t seed;
+
+    uint64_t random() {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    }
+
+    void beginSlice(uint64_t fiberId, uint64_t now, bool preemptible) {
+        sliceFiber.store(fiberId, std::memory_order_relaxed);
+        preempt.store(false, std::memory_order_relaxed);
+        sliceStart.store(now, std::memory_order_release);
+        if (preemptible) {
+            Fiber::setPreemptFlag(&preempt);
+        }
+    }
+
+    void endSlice() {
+        sliceStart.store(0, std::memory_order_relaxed);
+        Fiber::setPreemptFlag(nullptr);
+    }
+
+    // false if the worker retired
+    bool pushMail(FiberAndThread* task) {
+        Spinlock::Lock lock(mailboxMutex);
+        if (closed) {
+            return false;
+        }
+
+        if (mailboxTail) {
+            mailboxTail->next = task;
+        } else {
+            mailboxHead = task;
+        }
+        mailboxTail = task;
+        ++mailboxSize;
+        return true;
+    }
+
+    FiberAndThread* popMail() {
+        if (mailboxSize.load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+
+        Spinlock::Lock lock(mailboxMutex);
+        FiberAndThread* task = mailboxHead;
+        if (task) {
+            mailboxHead = task->next;
+            if (!mailboxHead) {
+                mailboxTail = nullptr;
+            }
+            task->next = nullptr;
+            --mailboxSize;
+        }
+        return task;
+    }
+};
+
 Scheduler::Scheduler(size_t threads, bool useCaller, const std::string& name): m_name{ name } {
     SERVER_ASSERT(threads > 0);
 
@@ -24,7 +422,13 @@ Scheduler::Scheduler(size_t threads, bool useCaller, const std::string& name): m
         SERVER_ASSERT(getThis() == nullptr);
         t_scheduler = this;
 
-        m_rootFiber = std::make_shared<Fiber>(std::bind(&Scheduler::run, this), 0, true);
+        m_workers.push_back(std::make_unique<Worker>(this, m_workers.size()));
+        Worker* worker = m_workers.back().get();
+        m_rootFiber = std::make_shared<Fiber>([this, worker]() {
+            t_worker = worker;
+            run();
+            t_worker = nullptr;
+        }, 0, true);
         
         // set current thread name as the name of scheduler
         Server::Thread::setName(m_name);
@@ -40,6 +444,11 @@ Scheduler::Scheduler(size_t threads, bool useCaller, const std::string& name): m
     }
 
     m_threadCount = threads;
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>(this, m_workers.size()));
+    }
+
+    initThreadTable();
 };
 
 Scheduler::~Scheduler() {
@@ -48,6 +457,36 @@ Scheduler::~Scheduler() {
     if (getThis() == this) {
         t_scheduler = nullptr;
     }
+
+    // release task nodes, queues are normally drained by now
+    FiberAndThread* task = nullptr;
+    for (auto& worker : m_workers) {
+        while (worker->tasks.steal(task)) {
+            delete task;
+        }
+
+        while ((task = worker->popMail())) {
+            delete task;
+        }
+
+        for (FiberAndThread* t : worker->freeTasks) {
+            delete t;
+        }
+    }
+
+    while (m_injectHead) {
+        task = m_injectHead;
+        m_injectHead = task->next;
+        delete task;
+    }
+
+    for (auto& group : m_groups) {
+        while (group->m_head) {
+            task = group->m_head;
+            group->m_head = task->next;
+            delete task;
+        }
+    }
 };
 
 Scheduler* Scheduler::getThis() {
@@ -58,6 +497,37 @@ Fiber* Scheduler::getMainFiber() {
     return t_fiber;
 };
 
+void Scheduler::switchTo(Scheduler* target, int thread) {
+    SERVER_ASSERT(target);
+    if (getThis() == target && (thread == -1 || thread == Server::getThreadId())) {
+        return;
+    }
+
+    Fiber::ptr cur = Fiber::getThis();
+    SERVER_ASSERT_INFO(cur->getStackMode() != Fiber::StackMode::SHARED,
+                       "shared-stack coroutine id = " + std::to_string(cur->getId()) + " cannot change thread");
+
+    // groups belong to the scheduler it leaves
+    cur->m_group = nullptr;
+
+    // it stays EXEC until it is off this thread, the target retries until then
+    target->schedule(cur, thread);
+    cur.reset();
+    Fiber::yieldToHold();
+}
+
+SchedulerSwitcher::SchedulerSwitcher(Scheduler* target): m_caller{ Scheduler::getThis() } {
+    if (target) {
+        Scheduler::switchTo(target);
+    }
+}
+
+SchedulerSwitcher::~SchedulerSwitcher() {
+    if (m_caller) {
+        Scheduler::switchTo(m_caller);
+    }
+}
+
 void Scheduler::start() {
     MutexType::Lock lock(m_mutex);
     if (m_isRunning){
@@ -65,22 +535,278 @@ void Scheduler::start() {
     }
 
     m_isRunning = true;
+    m_startMs = getCurrentMS();
 
     // the thread pool should be empty, no thread running in thread pool
     SERVER_ASSERT(m_threads.empty());
 
     m_threads.resize(m_threadCount);
-    for(size_t i = 0; i < m_threadCount; ++i) {
-        // create a number of threads in thread pool, to perform tasks concurrently
-        m_threads[i] = std::make_shared<Thread>(std::bind(&Scheduler::run, this),
-                                    m_name + "_" + std::to_string(i));
-        // record thread id
-        m_threadIds.push_back(m_threads[i]->getId());
+    // the caller thread is left where it is, only the pool is placed
+    m_affinity = planAffinity(m_name, m_threadCount);
+
+    // an elastic pool starts small, the supervisor adds threads on demand
+    size_t count = m_elastic ? m_minThreads : m_threadCount;
+    for(size_t i = 0; i < count; ++i) {
+        spawnWorker(i);
+    }
+
+    if (m_elastic || s_sliceBudget) {
+        if (s_sliceBudget) {
+            // SIGURG is ignored by default, a late signal only reaches the
+            // handler of the application, which has to expect spurious ones
+            static std::once_flag s_traceHandler;
+            std::call_once(s_traceHandler, []() {
+                struct sigaction sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sa_sigaction = &Scheduler::onTraceSignal;
+                sa.sa_flags = SA_RESTART | SA_SIGINFO;
+                sigemptyset(&sa.sa_mask);
+                sigaction(SIGURG, &sa, &s_prevTraceAction);
+            });
+        }
+        m_supervisor = std::make_shared<Thread>([this]() { supervise(); }, m_name + "_supervisor");
     }
 
     lock.unlock();
 };
 
+void Scheduler::setElastic(size_t minThreads, size_t maxThreads) {
+    MutexType::Lock lock(m_mutex);
+    SERVER_ASSERT(!m_isRunning);
+    SERVER_ASSERT(minThreads <= maxThreads && maxThreads > 0);
+
+    m_elastic = true;
+    m_minThreads = minThreads;
+
+    // a worker for every slot up front, m_workers never changes while running
+    m_workers.resize(m_workers.size() - m_threadCount);
+    for (size_t i = 0; i < maxThreads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>(this, m_workers.size()));
+    }
+    m_threadCount = maxThreads;
+
+    initThreadTable();
+}
+
+TaskGroup::ptr Scheduler::addGroup(const std::string& name, uint32_t weight, TaskPriority priority) {
+    SERVER_ASSERT(weight > 0);
+    Spinlock::Lock lock(m_groupMutex);
+    for (auto& group : m_groups) {
+        if (group->getName() == name) {
+            return group;
+        }
+    }
+
+    TaskGroup::ptr group(new TaskGroup(this, name, weight, priority));
+    m_groups.push_back(group);
+    m_groupClasses[static_cast<int>(priority)].push_back(group.get());
+    return group;
+}
+
+void Scheduler::getStats(Stats& stats) {
+    stats.startMs = m_startMs;
+    stats.timeMs = getCurrentMS();
+    stats.wakeups = m_externalWakeups;
+    stats.notifies = m_externalNotifies;
+    stats.queued = m_injectSize + m_groupQueued[0] + m_groupQueued[1];
+    for (auto& worker : m_workers) {
+        stats.queued += worker->tasks.size() + worker->mailboxSize;
+        stats.tasks += worker->tasksRun;
+        stats.idles += worker->idles;
+        stats.parks += worker->parks;
+        stats.steals += worker->steals;
+        stats.wakeups += worker->wakeups;
+        stats.notifies += worker->notifies;
+        stats.queueLatency.merge(worker->queueLatency);
+        stats.sliceTime.merge(worker->sliceTime);
+    }
+}
+
+void Scheduler::countWakeup() {
+    if (t_worker && t_worker->scheduler == this) {
+        bump(t_worker->wakeups);
+    } else {
+        ++m_externalWakeups;
+    }
+}
+
+void Scheduler::countNotify() {
+    if (t_worker && t_worker->scheduler == this) {
+        bump(t_worker->notifies);
+    } else {
+        ++m_externalNotifies;
+    }
+}
+
+double Scheduler::Stats::tasksPerSecond() const {
+    // a run shorter than the clock resolution counts as one millisecond
+    return startMs ? tasks * 1000.0 / std::max<uint64_t>(timeMs - startMs, 1) : 0;
+}
+
+double Scheduler::Stats::tasksPerSecond(const Stats& earlier) const {
+    return timeMs > earlier.timeMs ? (tasks - earlier.tasks) * 1000.0 / (timeMs - earlier.timeMs) : 0;
+}
+
+std::string Scheduler::Stats::toString() const {
+    std::stringstream ss;
+    ss << "tasks=" << tasks
+       << " tasks/s=" << static_cast<uint64_t>(tasksPerSecond())
+       << " queued=" << queued
+       << " idles=" << idles
+       << " parks=" << parks
+       << " steals=" << steals
+       << " wakeups=" << wakeups
+       << " notifies=" << notifies
+       << std::endl << "queue latency us: " << queueLatency.toString()
+       << std::endl << "slice time us: " << sliceTime.toString();
+    return ss.str();
+}
+
+TaskGroup::ptr Scheduler::getGroup(const std::string& name) {
+    Spinlock::Lock lock(m_groupMutex);
+    for (auto& group : m_groups) {
+        if (group->getName() == name) {
+            return group;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::spawnWorker(size_t slot) {
+    // workers of the pool follow the one of the caller thread
+    Worker* worker = m_workers[m_workers.size() - m_threadCount + slot].get();
+    std::vector<int> cpus = m_affinity[slot];
+    {
+        // a thread that found the worker before it retired may be mailing it
+        Spinlock::Lock lock(worker->mailboxMutex);
+        worker->closed = false;
+    }
+    worker->retired = false;
+    ++m_liveThreads;
+
+    // create a number of threads in thread pool, to perform tasks concurrently
+    m_threads[slot] = std::make_shared<Thread>([this, worker, cpus]() {
+                                    // pinned before the worker allocates anything, so its
+                                    // stacks, coroutine cache and task nodes are first
+                                    // touched on its own NUMA node
+                                    if (!cpus.empty()) {
+                                        Thread::setAffinity(cpus);
+                                    }
+                                    t_worker = worker;
+                                    run();
+                                    t_worker = nullptr;
+                                }, m_name + "_" + std::to_string(slot));
+    // record thread id
+    m_threadIds.push_back(m_threads[slot]->getId());
+    bindThread(worker, m_threads[slot]->getId());
+}
+
+void Scheduler::supervise() {
+    // progress of each worker when last seen and since when it stands still,
+    // BLOCKED_COUNTED once a thread was started in its place
+    static const uint64_t BLOCKED_COUNTED = UINT64_MAX;
+    std::vector<uint64_t> lastRuns(m_workers.size(), 0);
+    std::vector<uint64_t> runsSince(m_workers.size(), getCurrentMS());
+
+    // since when tasks are queued without any idle worker, 0 if they are not
+    uint64_t backlogSince = 0;
+
+    size_t first = m_workers.size() - m_threadCount;
+    while (m_isRunning) {
+        uint64_t queueWait = g_elasticQueueWait->getValue();
+        uint64_t blocked = g_elasticBlocked->getValue();
+        uint64_t budget = s_sliceBudget;
+
+        uint64_t interval = 100;
+        if (m_elastic) {
+            interval = std::min(queueWait, blocked) / 2;
+        }
+        if (budget) {
+            interval = std::min(interval, budget / 2);
+        }
+        m_supervisorParker.park(std::max<int64_t>(interval, 1));
+        if (!m_isRunning) {
+            break;
+        }
+
+        if (budget) {
+            checkSlices(budget * 1000);
+        }
+
+        if (!m_elastic) {
+            continue;
+        }
+
+        // join retired threads, their slots are free afterwards
+        std::vector<std::pair<size_t, Thread::ptr>> retired;
+        {
+            MutexType::Lock lock(m_mutex);
+            for (size_t i = 0; i < m_threadCount; ++i) {
+                if (m_threads[i] && m_workers[first + i]->retired) {
+                    retired.emplace_back(i, m_threads[i]);
+                }
+            }
+        }
+
+        for (auto& i : retired) {
+            i.second->join();
+        }
+
+        uint64_t now = getCurrentMS();
+        std::vector<size_t> stuck;
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            uint64_t runs = m_workers[i]->runs.load(std::memory_order_relaxed);
+            if (runs != lastRuns[i]) {
+                lastRuns[i] = runs;
+                runsSince[i] = now;
+            } else if ((runs & 1) && runsSince[i] != BLOCKED_COUNTED && now - runsSince[i] >= blocked) {
+                stuck.push_back(i);
+            }
+        }
+
+        size_t pending = m_pendingTasks;
+        size_t active = m_activeThreadCount;
+        size_t queued = pending > active ? pending - active : 0;
+
+        size_t grow = 0;
+        if (!queued) {
+            backlogSince = 0;
+        } else {
+            if (m_idleThreadCount) {
+                backlogSince = 0;
+            } else if (!backlogSince) {
+                backlogSince = now;
+            } else if (now - backlogSince >= queueWait) {
+                grow = 1;
+                backlogSince = now;
+            }
+
+            // a blocked worker is replaced once per task it blocks in
+            size_t replaced = std::min(stuck.size(), queued);
+            for (size_t i = 0; i < replaced; ++i) {
+                runsSince[stuck[i]] = BLOCKED_COUNTED;
+            }
+            grow = std::max(grow, replaced);
+        }
+
+        MutexType::Lock lock(m_mutex);
+        for (auto& i : retired) {
+            m_threadIds.erase(std::remove(m_threadIds.begin(), m_threadIds.end(), i.second->getId()),
+                              m_threadIds.end());
+            m_threads[i.first].reset();
+        }
+
+        for (size_t i = 0; i < m_threadCount && grow && m_isRunning; ++i) {
+            if (!m_threads[i]) {
+                spawnWorker(i);
+                --grow;
+                SERVER_LOG_INFO(g_logger) << m_name << " grows to " << m_liveThreads << " threads, queued: " << queued
+                                        << " blocked: " << stuck.size();
+            }
+        }
+    }
+}
+
 void Scheduler::stop() {
     m_autoStop = true;
     // check if main coroutine is terminated (thread pool is stopped)
@@ -108,6 +834,14 @@ void Scheduler::stop() {
     }
 
     m_isRunning = false;
+
+    // no thread is started once the pool is being joined
+    if (m_supervisor) {
+        m_supervisorParker.unpark();
+        m_supervisor->join();
+        m_supervisor.reset();
+    }
+
     for (size_t i = 0; i < m_threadCount; ++i) {
         notify();
     }
@@ -131,10 +865,74 @@ void Scheduler::stop() {
     }
 
     for (auto& t : threads) {
-        t->join();
+        if (t) {
+            t->join();
+        }
     }
+    m_liveThreads = 0;
 };
 
+void Scheduler::checkSlices(uint64_t budgetUs) {
+    uint64_t now = getCurrentUS();
+    for (auto& w : m_workers) {
+        Worker* worker = w.get();
+        uint64_t start = worker->sliceStart.load(std::memory_order_acquire);
+        if (!start || now < start + budgetUs) {
+            continue;
+        }
+
+        // yields at its next preemption point, if it has one. it is only
+        // reported when it keeps running for another budget
+        worker->preempt.store(true, std::memory_order_relaxed);
+        if (now < start + 2 * budgetUs || worker->reportedSlice == start) {
+            continue;
+        }
+        worker->reportedSlice = start;
+
+        // the thread records its own stack in the signal handler
+        worker->traceReady = false;
+        worker->traceRequested = true;
+        if (pthread_kill(worker->pthread, SIGURG) == 0) {
+            for (int i = 0; i < 100 && !worker->traceReady; ++i) {
+                usleep(100);
+            }
+        }
+        worker->traceRequested = false;
+
+        std::stringstream ss;
+        if (worker->traceReady) {
+            char** symbols = backtrace_symbols(worker->trace, worker->traceDepth);
+            // skip the frames of the handler and the signal trampoline
+            for (int i = 2; symbols && i < worker->traceDepth; ++i) {
+                ss << std::endl << "    " << symbols[i];
+            }
+            free(symbols);
+        }
+
+        SERVER_LOG_WARN(g_logger) << m_name << " thread " << worker->threadId << " runs coroutine "
+                                << worker->sliceFiber << " for " << (now - start) / 1000
+                                << "ms without yielding" << ss.str();
+    }
+}
+
+void Scheduler::onTraceSignal(int sig, siginfo_t* info, void* ctx) {
+    Worker* worker = t_worker;
+    if (!worker || !worker->traceRequested.exchange(false)) {
+        const struct sigaction& prev = s_prevTraceAction;
+        if (prev.sa_flags & SA_SIGINFO) {
+            prev.sa_sigaction(sig, info, ctx);
+        } else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+            prev.sa_handler(sig);
+        }
+        return;
+    }
+
+    int savedErrno = errno;
+    worker->traceDepth = backtrace(worker->trace, Worker::TRACE_DEPTH);
+    worker->traceReady.store(true, std::memory_order_release);
+    errno = savedErrno;
+}
+
 void Scheduler::setThis() {
     t_scheduler = this;
 }
@@ -143,125 +941,748 @@ void Scheduler::run() {
     SERVER_LOG_INFO(g_logger) << m_name << "run";
     setThis();
 
+    Worker* worker = t_worker;
+    int threadId = Server::getThreadId();
+    bindThread(worker, threadId);
+
     // a sub thread in thread pool
-    if (Server::getThreadId() != m_rootThread) {
+    if (threadId != m_rootThread) {
         // set up sub coroutine 
         t_fiber = Fiber::getThis().get();
     } 
 
-    Fiber::ptr idleFiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle,this));
+    // fill coroutine cache of this worker before tasks arrive
+    Fiber::prewarm(g_prewarmFibers->getValue());
+
+    worker->pthread = pthread_self();
+    if (s_sliceBudget) {
+        // the first backtrace() loads the unwinder, not in a signal handler
+        backtrace(worker->trace, 1);
+    }
+
+    Fiber::ptr idleFiber = Fiber::create(std::bind(&Scheduler::idle, this));
     Fiber::ptr cbFiber = nullptr;
-    
+
     FiberAndThread ft;
     while(true) {
         ft.reset();
-        bool notifyMe = false;
-        bool isActive = false;
-        {
-            // retrieve message from message queue
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while (it != m_fibers.end()) {
-                // current coroutine is assigned to specific thread
-                if (it->thread != -1 && it->thread != Server::getThreadId()) {
-                    ++it;
-                    notifyMe = true;
+        FiberAndThread* task = nextTask(worker);
+        if (task) {
+            SERVER_ASSERT(task->fiber || task->cb || task->handle);
+            if (task->thread != -1 && task->thread != threadId) {
+                // pinned before its thread was known, pass it on if it is now
+                Worker* target = workerOf(task->thread);
+                if (target && target != worker) {
+                    enqueue(task);
                     continue;
                 }
+                task->thread = -1;
+            }
 
-                SERVER_ASSERT(it->fiber || it->cb);
-                // skip if next message is current coroutine which is executed by other threads
-                if (it->fiber && it->fiber->getState() == Fiber::State::EXEC) {
-                    ++it;
-                    continue;
-                }
-                
-                // retrieve next message from MQ
-                ft = *it;
-                m_fibers.erase(it);
-                ++m_activeThreadCount;
-                isActive = true;
-                break;
+            // coroutine still switching out on the thread that woke it, retry later
+            if (task->fiber && task->fiber->getState() == Fiber::State::EXEC) {
+                enqueue(task);
+                continue;
             }
+
+            ft = std::move(*task);
+            freeTask(task);
+            ++m_activeThreadCount;
+            bump(worker->runs);
+            bump(worker->tasksRun);
         }
 
-        if (notifyMe) {
-            notify();
+        // a grouped task is charged for the time it runs, the watchdog
+        // times every slice, sampled tasks carry the time they were queued
+        TaskGroup* group = ft.group;
+        bool watched = s_sliceBudget.load(std::memory_order_relaxed) > 0;
+        uint64_t startUs = group || watched || ft.queuedUs ? getCurrentUS() : 0;
+        if (ft.queuedUs) {
+            worker->queueLatency.addUnshared(startUs > ft.queuedUs ? startUs - ft.queuedUs : 0);
         }
 
         if (ft.fiber && (ft.fiber->getState() != Fiber::State::TERM
                         && ft.fiber->getState() != Fiber::State::EXCEPT)) {
-            // next message is a coroutine
-            ft.fiber->swapIn();
+            // next message is a coroutine, a held one may already be
+            // resumed by another thread once swapIn returns
+            if (watched) {
+                worker->beginSlice(ft.fiber->getId(), startUs, true);
+            }
+            ft.fiber->m_group = group;
+            Fiber::State state = ft.fiber->swapIn();
+            if (watched) {
+                worker->endSlice();
+            }
             --m_activeThreadCount;
 
-            if (ft.fiber->getState() == Fiber::State::READY) {
-                schedule(ft.fiber);
-            } else if (ft.fiber->getState() != Fiber::State::TERM
-                    && ft.fiber->getState() != Fiber::State::EXCEPT){
-                ft.fiber->m_state = Fiber::State::HOLD;
+            if (state == Fiber::State::READY) {
+                // a yielding coroutine stays in its group
+                ft.thread = -1;
+                submit(std::move(ft));
             }
 
             ft.reset();
+            taskDone(group, startUs);
+        } else if (ft.handle) {
+            // stackless coroutine runs until its next suspension point
+            std::coroutine_handle<> handle = ft.handle;
+            ft.reset();
+            // it runs on the stack of this loop, which must not yield
+            if (watched) {
+                worker->beginSlice(0, startUs, false);
+            }
+            handle.resume();
+            if (watched) {
+                worker->endSlice();
+            }
+            --m_activeThreadCount;
+            taskDone(group, startUs);
         } else if (ft.cb) {
             // next message is a callback
             if (cbFiber) {
-                cbFiber->reset(ft.cb);
+                cbFiber->reset(std::move(ft.cb));
             } else {
-                cbFiber = std::make_shared<Fiber>(ft.cb);
-                ft.cb = nullptr;
+                cbFiber = Fiber::create(std::move(ft.cb));
             }
+            cbFiber->m_group = group;
             ft.reset();
-            cbFiber->swapIn();
+            if (watched) {
+                worker->beginSlice(cbFiber->getId(), startUs, true);
+            }
+            Fiber::State state = cbFiber->swapIn();
+            if (watched) {
+                worker->endSlice();
+            }
             --m_activeThreadCount;
-            if (cbFiber->getState() == Fiber::State::READY) {
-                schedule(cbFiber);
-                cbFiber.reset();
-            } else if (cbFiber->getState() == Fiber::State::EXCEPT
-                    || cbFiber->getState() == Fiber::State::TERM) {
+            if (state == Fiber::State::READY) {
+                FiberAndThread ready(std::move(cbFiber), -1);
+                ready.group = group;
+                submit(std::move(ready));
+            } else if (state == Fiber::State::EXCEPT
+                    || state == Fiber::State::TERM) {
                 cbFiber->reset(nullptr);
             } else {
-                cbFiber->m_state = Fiber::State::HOLD;
+                // held coroutine belongs to whoever wakes it up
                 cbFiber.reset();
             }
+            taskDone(group, startUs);
         } else {
-            if (isActive) {
+            if (task) {
+                // coroutine finished before it was taken
                 --m_activeThreadCount;
+                taskDone();
                 continue;
             }
 
             // message queue is empty, we are in idle state
-            if (idleFiber->getState() == Fiber::State::TERM) {
-                SERVER_LOG_INFO(g_logger) << "idle fiber term";
-                break;
-            }
-            
+            bump(worker->idles);
             ++m_idleThreadCount;
             idleFiber->swapIn();
             --m_idleThreadCount;
-            if(idleFiber->getState() != Fiber::State::TERM
-                && idleFiber->getState() != Fiber::State::EXCEPT) {
-                idleFiber->m_state = Fiber::State::HOLD;
+
+            // idle coroutine returns once the scheduler stopped or the thread retired
+            if (idleFiber->getState() == Fiber::State::TERM) {
+                SERVER_LOG_INFO(g_logger) << "idle fiber term";
+                break;
             }
         }
     }
 };
 
 void Scheduler::notify(){
-    SERVER_LOG_INFO(g_logger) << "notify";
+    if (!hasIdleThreads()) {
+        return;
+    }
+
+    unparkOne();
 };
 
 bool Scheduler::stopped(){
-    MutexType::Lock lock(m_mutex);
     return m_autoStop 
         && !m_isRunning
-        && m_fibers.empty()
+        && m_pendingTasks == 0
         && m_activeThreadCount == 0;
 };
 
+void Scheduler::submit(FiberAndThread&& ft) {
+    if (ft.fiber && ft.thread == -1) {
+        // shared-stack coroutine can only resume on the thread owning its stack
+        ft.thread = ft.fiber->getBoundThread();
+    }
+
+    // a coroutine woken after parking goes back to the group it ran in
+    if (ft.fiber && !ft.group) {
+        ft.group = ft.fiber->m_group;
+    }
+
+    FiberAndThread* task = allocTask();
+    *task = std::move(ft);
+    task->queuedUs = sampleQueuedTime();
+
+    // counted before it is visible, so stopped() never misses a queued task
+    ++m_pendingTasks;
+    enqueue(task);
+}
+
+void Scheduler::submitBatch(FiberAndThread* head, size_t count) {
+    m_pendingTasks += count;
+
+    // pinned tasks go to their mailboxes one by one, the others are chained
+    FiberAndThread* batchHead = nullptr;
+    FiberAndThread* batchTail = nullptr;
+    size_t n = 0;
+    while (head) {
+        FiberAndThread* task = head;
+        head = task->next;
+        task->next = nullptr;
+        task->queuedUs = sampleQueuedTime();
+
+        if (task->fiber && task->thread == -1) {
+            task->thread = task->fiber->getBoundThread();
+        }
+
+        if (task->fiber && !task->group) {
+            task->group = task->fiber->m_group;
+        }
+
+        if (task->thread != -1) {
+            enqueue(task);
+            continue;
+        }
+
+        if (batchTail) {
+            batchTail->next = task;
+        } else {
+            batchHead = task;
+        }
+        batchTail = task;
+        ++n;
+    }
+
+    if (!n) {
+        return;
+    }
+
+    if (t_worker && t_worker->scheduler == this) {
+        while (batchHead) {
+            FiberAndThread* task = batchHead;
+            batchHead = task->next;
+            task->next = nullptr;
+            t_worker->tasks.push(task);
+        }
+    } else {
+        MutexType::Lock lock(m_mutex);
+        if (m_injectTail) {
+            m_injectTail->next = batchHead;
+        } else {
+            m_injectHead = batchHead;
+        }
+        m_injectTail = batchTail;
+        m_injectSize += n;
+    }
+
+    // one idle worker per task at most, the others keep running
+    size_t idle = m_idleThreadCount;
+    for (size_t i = 0; i < n && i < idle; ++i) {
+        notify();
+    }
+}
+
+void Scheduler::enqueue(FiberAndThread* task) {
+    task->next = nullptr;
+    if (task->thread != -1) {
+        Worker* target = workerOf(task->thread);
+        if (target && target->pushMail(task)) {
+            // only the owner can run it, wake it alone if it sleeps
+            int state = target->sleepState;
+            if (state == Worker::PARKED) {
+                if (target->sleepState.compare_exchange_strong(state, Worker::RUNNING)) {
+                    target->parker.unpark();
+                    countWakeup();
+                }
+            } else if (state == Worker::POLLING) {
+                notifyPoller();
+            }
+            return;
+        }
+    } else if (task->group) {
+        enqueueGrouped(task);
+        return;
+    } else if (t_worker && t_worker->scheduler == this) {
+        // submitted by a worker of ours, no lock needed. an idle worker is
+        // woken on every push, not only when the deque was empty: a thief
+        // between its scan of the peers and parking would miss it. the fence
+        // pairs with the one in parkWorker(), either the thief sees the task
+        // or this sees it parked
+        t_worker->tasks.push(task);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        notify();
+        return;
+    }
+
+    bool wasEmpty = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        wasEmpty = !m_injectHead;
+        if (m_injectTail) {
+            m_injectTail->next = task;
+        } else {
+            m_injectHead = task;
+        }
+        m_injectTail = task;
+        ++m_injectSize;
+    }
+
+    if (wasEmpty) {
+        notify();
+    }
+}
+
+void Scheduler::enqueueGrouped(FiberAndThread* task) {
+    TaskGroup* group = task->group;
+    int priority = static_cast<int>(group->m_priority);
+    task->queuedUs = getCurrentUS();
+
+    bool wasEmpty = false;
+    {
+        Spinlock::Lock lock(m_groupMutex);
+        if (group->m_tail) {
+            group->m_tail->next = task;
+        } else {
+            group->m_head = task;
+        }
+        group->m_tail = task;
+        ++group->m_queued;
+        wasEmpty = m_groupQueued[priority]++ == 0;
+    }
+
+    if (wasEmpty) {
+        notify();
+    }
+}
+
+Scheduler::FiberAndThread* Scheduler::takeGrouped(TaskPriority priority) {
+    int p = static_cast<int>(priority);
+    if (m_groupQueued[p].load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+
+    FiberAndThread* task = nullptr;
+    {
+        Spinlock::Lock lock(m_groupMutex);
+        std::vector<TaskGroup*>& groups = m_groupClasses[p];
+        size_t count = groups.size();
+        size_t& cursor = m_groupCursor[p];
+
+        // the group in turn runs until its deficit is used up, then the next
+        // one with tasks and deficit left gets the turn
+        for (int pass = 0; pass < 2 && !task; ++pass) {
+            for (size_t i = 0; i < count; ++i) {
+                TaskGroup* group = groups[(cursor + i) % count];
+                if (group->m_head && group->m_deficit > 0) {
+                    cursor = (cursor + i) % count;
+                    task = group->m_head;
+                    group->m_head = task->next;
+                    if (!group->m_head) {
+                        group->m_tail = nullptr;
+                    }
+                    task->next = nullptr;
+                    --group->m_queued;
+                    --m_groupQueued[p];
+                    break;
+                }
+            }
+
+            if (task) {
+                break;
+            }
+
+            // every group with tasks is out of deficit, run as many rounds at
+            // once as the least indebted one needs to be served again
+            int64_t rounds = INT64_MAX;
+            for (TaskGroup* group : groups) {
+                if (group->m_head) {
+                    int64_t quantum = group->m_weight * GROUP_QUANTUM_US;
+                    rounds = std::min<int64_t>(rounds, -group->m_deficit / quantum + 1);
+                }
+            }
+
+            if (rounds == INT64_MAX) {
+                // drained by other workers meanwhile
+                return nullptr;
+            }
+
+            for (TaskGroup* group : groups) {
+                if (group->m_head) {
+                    group->m_deficit += rounds * group->m_weight * GROUP_QUANTUM_US;
+                }
+            }
+            cursor = (cursor + 1) % count;
+        }
+    }
+
+    if (!task) {
+        return nullptr;
+    }
+
+    TaskGroup* group = task->group;
+    uint64_t waitUs = getCurrentUS() - task->queuedUs;
+    ++group->m_dispatched;
+    group->m_waitUs += waitUs;
+    uint64_t maxWaitUs = group->m_maxWaitUs;
+    while (waitUs > maxWaitUs && !group->m_maxWaitUs.compare_exchange_weak(maxWaitUs, waitUs));
+
+    // more queued, let an idle worker help
+    if (m_groupQueued[p].load(std::memory_order_relaxed)) {
+        notify();
+    }
+    return task;
+}
+
+void Scheduler::taskDone(TaskGroup* group, uint64_t startUs) {
+    bump(t_worker->runs);
+
+    if (startUs) {
+        uint64_t runUs = getCurrentUS() - startUs;
+        t_worker->sliceTime.addUnshared(runUs);
+        if (group) {
+            group->m_deficit -= runUs;
+            group->m_runUs += runUs;
+        }
+    }
+
+    // last task after stop(), idle workers may wait for it to see stopped()
+    if (--m_pendingTasks == 0 && m_autoStop) {
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            notify();
+        }
+    }
+}
+
+Scheduler::FiberAndThread* Scheduler::nextTask(Worker* worker) {
+    FiberAndThread* task = nullptr;
+
+    auto takeInjected = [&]() -> bool {
+        if (m_injectSize.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+
+        MutexType::Lock lock(m_mutex);
+        // take a fair share of the queue, keep all but the first locally
+        size_t n = m_injectSize / (m_liveThreads + (m_rootThread != -1)) + 1;
+        if (n > INJECT_BATCH) {
+            n = INJECT_BATCH;
+        }
+        for (size_t i = 0; i < n && m_injectHead; ++i) {
+            FiberAndThread* t = m_injectHead;
+            m_injectHead = t->next;
+            t->next = nullptr;
+            --m_injectSize;
+            if (task) {
+                worker->tasks.push(t);
+            } else {
+                task = t;
+            }
+        }
+
+        if (!m_injectHead) {
+            m_injectTail = nullptr;
+        }
+        lock.unlock();
+
+        // the rest of the batch can be stolen by an idle worker
+        if (!worker->tasks.empty()) {
+            notify();
+        }
+        return task != nullptr;
+    };
+
+    // interactive groups come before anything else
+    if ((task = takeGrouped(TaskPriority::INTERACTIVE))) {
+        return task;
+    }
+
+    if (++worker->tick % INJECT_INTERVAL == 0) {
+        // batch groups are not starved by a steady stream of other tasks
+        if (takeInjected() || (task = takeGrouped(TaskPriority::BATCH))) {
+            return task;
+        }
+    }
+
+    if ((task = worker->popMail())) {
+        return task;
+    }
+
+    if (worker->tasks.steal(task)) {
+        return task;
+    }
+
+    if (takeInjected()) {
+        return task;
+    }
+
+    if ((task = takeGrouped(TaskPriority::BATCH))) {
+        return task;
+    }
+
+    // local queues are empty, steal from a random victim onwards
+    size_t count = m_workers.size();
+    size_t start = worker->random() % count;
+    for (size_t i = 0; i < count; ++i) {
+        Worker* victim = m_workers[(start + i) % count].get();
+        if (victim != worker && victim->tasks.steal(task)) {
+            bump(worker->steals);
+            // more to take, let a parked worker help
+            if (!victim->tasks.empty()) {
+                notify();
+            }
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+static size_t threadHash(int thread) {
+    return static_cast<uint32_t>(thread) * 0x9e3779b1U;
+}
+
+Scheduler::Worker* Scheduler::workerOf(int thread) {
+    size_t hash = threadHash(thread);
+    for (size_t i = 0; i <= m_threadTableMask; ++i) {
+        ThreadSlot& slot = m_threadTable[(hash + i) & m_threadTableMask];
+        int cur = slot.thread.load(std::memory_order_acquire);
+        if (cur == thread) {
+            // nullptr while the slot is being filled
+            return slot.worker.load(std::memory_order_acquire);
+        }
+
+        if (cur == 0) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::bindThread(Worker* worker, int thread) {
+    worker->threadId = thread;
+    size_t hash = threadHash(thread);
+    while (true) {
+        // reuse the slot of a retired thread unless thread is bound already
+        ThreadSlot* free = nullptr;
+        int freeValue = 0;
+        for (size_t i = 0; i <= m_threadTableMask; ++i) {
+            ThreadSlot& slot = m_threadTable[(hash + i) & m_threadTableMask];
+            int cur = slot.thread.load(std::memory_order_acquire);
+            if (cur == thread) {
+                slot.worker.store(worker, std::memory_order_release);
+                return;
+            }
+
+            if ((cur == -1 || cur == 0) && !free) {
+                free = &slot;
+                freeValue = cur;
+            }
+
+            if (cur == 0) {
+                break;
+            }
+        }
+
+        SERVER_ASSERT_INFO(free, "thread table of scheduler " + m_name + " is full");
+        // start() and the thread itself may bind it at once, either slot does
+        if (free->thread.compare_exchange_strong(freeValue, thread)) {
+            free->worker.store(worker, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+void Scheduler::unbindThread(int thread) {
+    size_t hash = threadHash(thread);
+    for (size_t i = 0; i <= m_threadTableMask; ++i) {
+        ThreadSlot& slot = m_threadTable[(hash + i) & m_threadTableMask];
+        int cur = slot.thread.load(std::memory_order_acquire);
+        if (cur == thread) {
+            slot.worker.store(nullptr, std::memory_order_release);
+            slot.thread.store(-1, std::memory_order_release);
+        } else if (cur == 0) {
+            return;
+        }
+    }
+}
+
+void Scheduler::initThreadTable() {
+    // a quarter full at most, counting a thread bound twice, so a lookup
+    // probes few slots
+    size_t slots = 4;
+    while (slots < 4 * m_workers.size()) {
+        slots <<= 1;
+    }
+    m_threadTable.reset(new ThreadSlot[slots]);
+    m_threadTableMask = slots - 1;
+
+    if (m_rootThread != -1) {
+        bindThread(m_workers.front().get(), m_rootThread);
+    }
+}
+
+bool Scheduler::parkWorker(int64_t timeoutMs, const std::function<bool()>& recheck) {
+    Worker* worker = t_worker;
+    SERVER_ASSERT(worker && worker->scheduler == this);
+
+    // marked before the checks, a task queued after them sees the mark. the
+    // deques of the peers are checked again too: a push after the scan in
+    // spinForWork() notifies without finding this worker parked
+    worker->sleepState = Worker::PARKED;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (hasPendingWork() || hasStealableWork() || (recheck && !recheck())) {
+        worker->sleepState = Worker::RUNNING;
+        return true;
+    }
+
+    bump(worker->parks);
+    worker->parker.park(timeoutMs);
+
+    // still marked when nobody picked this worker
+    int state = Worker::PARKED;
+    return !worker->sleepState.compare_exchange_strong(state, Worker::RUNNING);
+}
+
+int64_t Scheduler::retireTimeout() const {
+    return m_elastic ? s_idleTimeout.load(std::memory_order_relaxed) : -1;
+}
+
+bool Scheduler::tryRetire() {
+    Worker* worker = t_worker;
+    int threadId = worker->threadId;
+    // the caller thread stays, so do threads holding frames of shared-stack coroutines
+    if (!m_elastic || !m_isRunning || threadId == m_rootThread || Fiber::boundFibers()) {
+        return false;
+    }
+
+    size_t live = m_liveThreads;
+    do {
+        if (live <= m_minThreads) {
+            return false;
+        }
+    } while (!m_liveThreads.compare_exchange_weak(live, live - 1));
+
+    {
+        Spinlock::Lock lock(worker->mailboxMutex);
+        worker->closed = true;
+    }
+
+    // checked after the mailbox is closed, nothing can be left behind then
+    if (hasPendingWork()) {
+        Spinlock::Lock lock(worker->mailboxMutex);
+        worker->closed = false;
+        ++m_liveThreads;
+        return false;
+    }
+
+    unbindThread(threadId);
+    worker->retired = true;
+    m_supervisorParker.unpark();
+    SERVER_LOG_INFO(g_logger) << m_name << " retires idle thread " << threadId
+                            << ", " << m_liveThreads << " threads left";
+    return true;
+}
+
+bool Scheduler::unparkOne() {
+    for (auto& worker : m_workers) {
+        int state = Worker::PARKED;
+        if (worker->sleepState.compare_exchange_strong(state, Worker::RUNNING)) {
+            worker->parker.unpark();
+            countWakeup();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::setPolling(bool polling) {
+    t_worker->sleepState = polling ? Worker::POLLING : Worker::RUNNING;
+}
+
+bool Scheduler::spinForWork() {
+    uint32_t rounds = s_spinCount.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < rounds; ++i) {
+        if (hasPendingWork() || stopped()) {
+            return true;
+        }
+        cpuRelax();
+    }
+
+    // queues of the other workers are scanned once, parkWorker() scans them
+    // again after marking the worker parked
+    return hasStealableWork();
+}
+
+bool Scheduler::hasStealableWork() {
+    for (auto& worker : m_workers) {
+        if (!worker->tasks.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasPendingWork() {
+    Worker* worker = t_worker;
+    return worker->mailboxSize
+        || !worker->tasks.empty()
+        || m_injectSize
+        || m_groupQueued[0]
+        || m_groupQueued[1];
+}
+
+Scheduler::FiberAndThread* Scheduler::allocTask() {
+    if (t_worker && !t_worker->freeTasks.empty()) {
+        FiberAndThread* task = t_worker->freeTasks.back();
+        t_worker->freeTasks.pop_back();
+        return task;
+    }
+    return new FiberAndThread();
+}
+
+void Scheduler::freeTask(FiberAndThread* task) {
+    // nodes are alike in every scheduler, keep it in the cache of this thread
+    if (t_worker && t_worker->freeTasks.size() < FREE_TASK_MAX) {
+        task->reset();
+        t_worker->freeTasks.push_back(task);
+    } else {
+        delete task;
+    }
+}
+
+TaskGroup::TaskGroup(Scheduler* scheduler, const std::string& name, uint32_t weight, TaskPriority priority)
+    : m_scheduler{ scheduler },
+    m_name{ name },
+    m_weight{ weight },
+    m_priority{ priority } {
+}
+
+TaskGroup::Stats TaskGroup::getStats() const {
+    Stats stats;
+    stats.queued = m_queued;
+    stats.dispatched = m_dispatched;
+    stats.waitUs = m_waitUs;
+    stats.maxWaitUs = m_maxWaitUs;
+    stats.runUs = m_runUs;
+    return stats;
+}
+
 void Scheduler::idle(){
     SERVER_LOG_INFO(g_logger) << "idle";
     while(!stopped()) {
+        // work often arrives within microseconds, spin before paying for a
+        // futex sleep and wakeup
+        if (!spinForWork()
+            && !parkWorker(retireTimeout(), [this]() { return !stopped(); })
+            && tryRetire()) {
+            return;
+        }
         Server::Fiber::yieldToHold();
     }
 };
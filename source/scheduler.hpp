@@ -1,20 +1,74 @@
 #ifndef __SERVER_SCHEDULER_HPP__
 #define __SERVER_SCHEDULER_HPP__
 
+#include <coroutine>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <ranges>
+#include <signal.h>
 #include <vector>
-#include <list>
 
 #include "fiber.hpp"
+#include "histogram.hpp"
 #include "mutex.hpp"
 #include "thread.hpp"
+#include "work_queue.hpp"
 
 namespace Server {
 
+class TaskGroup;
+
+// priority class of a task group, INTERACTIVE groups are served before
+// tasks without a group, BATCH groups after them
+enum class TaskPriority {
+    INTERACTIVE = 0,
+    BATCH = 1
+};
+
 class Scheduler {
 public:
     using ptr = std::shared_ptr<Scheduler>;
     using MutexType = Mutex;
+
+    // telemetry summed over the workers by getStats()
+    struct Stats {
+        // tasks taken from the queues
+        uint64_t tasks = 0;
+
+        // tasks waiting in the queues when the stats were taken
+        uint64_t queued = 0;
+
+        // times a worker ran out of tasks, and times it went to sleep then
+        uint64_t idles = 0;
+        uint64_t parks = 0;
+
+        // tasks taken from the queue of another worker
+        uint64_t steals = 0;
+
+        // parked workers woken up, poller interrupts included
+        uint64_t wakeups = 0;
+
+        // poller interrupts asked for, one still pending absorbs the others
+        // so only some of them count as wakeups
+        uint64_t notifies = 0;
+
+        // microseconds from queueing to running and of one run until the
+        // task yields or returns, of the tasks timed by scheduler.stats_sample
+        Log2Histogram queueLatency;
+        Log2Histogram sliceTime;
+
+        // when the scheduler started and when the stats were taken, in
+        // milliseconds of getCurrentMS()
+        uint64_t startMs = 0;
+        uint64_t timeMs = 0;
+
+        // tasks per second since start, or since earlier stats were taken
+        double tasksPerSecond() const;
+        double tasksPerSecond(const Stats& earlier) const;
+
+        std::string toString() const;
+    };
     
     
     // Constructor
@@ -33,6 +87,11 @@ public:
 
     // retrieve pointer to main coroutine
     static Fiber* getMainFiber();
+
+    // move the current coroutine onto target, or onto thread of target if it
+    // is not -1, and return once it runs there. its stack goes along, so a
+    // handler keeps its locals. coroutines on shared stacks cannot move
+    static void switchTo(Scheduler* target, int thread = -1);
     
     // start scheduler
     void start();
@@ -40,38 +99,93 @@ public:
     // stop scheduler
     void stop();
 
-    // schedule a functional object or coroutine
-    // fc: functional object or coroutine to be executed
+    // let the pool grow from minThreads up to maxThreads threads while tasks
+    // queue up or workers block, threads idle for scheduler.elastic.idle_timeout_ms
+    // retire again. the caller thread is not counted, call before start()
+    void setElastic(size_t minThreads, size_t maxThreads);
+
+    // number of threads of the pool currently running
+    size_t getThreadCount() const { return m_liveThreads; }
+
+    // number of workers without a task to run
+    size_t getIdleThreadCount() const { return m_idleThreadCount; }
+
+    // group named name, created with weight and priority if it does not exist
+    std::shared_ptr<TaskGroup> addGroup(const std::string& name, uint32_t weight = 1,
+                                        TaskPriority priority = TaskPriority::BATCH);
+
+    // group named name, nullptr if there is none
+    std::shared_ptr<TaskGroup> getGroup(const std::string& name);
+
+    // sum the per-thread counters and histograms into stats, which should
+    // be newly constructed
+    void getStats(Stats& stats);
+
+    // schedule a functional object or coroutine, from a worker of this
+    // scheduler a callback fitting Callable::INLINE_SIZE allocates nothing
+    // once the worker's node cache is warm, from another thread the queue
+    // node is allocated
+    // fc: functional object, fiber or C++20 coroutine handle to be executed,
+    //     pointers to a Fiber::ptr or Callable are moved from
     // thread: specify thread to execute task     
     template<typename FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
-        bool needNotify = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            needNotify = scheduleNoLock(fc, thread);   
+        requires (!std::ranges::range<std::remove_cvref_t<FiberOrCb>>)
+    void schedule(FiberOrCb&& fc, int thread = -1) {
+        FiberAndThread ft(std::forward<FiberOrCb>(fc), thread);
+        if (ft.fiber || ft.cb || ft.handle) {
+            submit(std::move(ft));
         }
+    }
 
-        if (needNotify) {
-            notify();
+    // schedule a task in group, groups of a priority class share the cpu in
+    // proportion to their weights. a coroutine bound to a thread ignores group,
+    // one that parks is queued in its group again when woken up
+    template<typename FiberOrCb>
+        requires (!std::ranges::range<std::remove_cvref_t<FiberOrCb>>)
+    void schedule(FiberOrCb&& fc, const std::shared_ptr<TaskGroup>& group) {
+        FiberAndThread ft(std::forward<FiberOrCb>(fc), -1);
+        if (ft.fiber || ft.cb || ft.handle) {
+            ft.group = group.get();
+            submit(std::move(ft));
         }
     }
 
-    template<typename InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
-        bool needNotify = false;
+    // schedule every task of [begin, end) with one critical section and
+    // wake at most as many idle workers as there are tasks. elements are
+    // moved from, pass const iterators to copy them
+    template<std::input_iterator InputIterator>
+    void schedule(InputIterator begin, InputIterator end, int thread = -1) {
+        FiberAndThread* head = nullptr;
+        FiberAndThread* tail = nullptr;
+        size_t count = 0;
+        for (; begin != end; ++begin) {
+            FiberAndThread ft(std::move(*begin), thread);
+            if (!ft.fiber && !ft.cb && !ft.handle) {
+                continue;
+            }
 
-        {
-            MutexType::Lock lock(m_mutex);
-            while (begin++ != end) {
-                needNotify = scheduleNoLock(&*begin) || needNotify;
+            FiberAndThread* task = allocTask();
+            *task = std::move(ft);
+            if (tail) {
+                tail->next = task;
+            } else {
+                head = task;
             }
+            tail = task;
+            ++count;
         }
 
-        if (needNotify) {
-            notify();
+        if (count) {
+            submitBatch(head, count);
         }
     }
 
+    // schedule a range of tasks, e.g. a std::vector or std::span, see above
+    template<std::ranges::input_range Range>
+    void schedule(Range&& tasks, int thread = -1) {
+        schedule(std::ranges::begin(tasks), std::ranges::end(tasks), thread);
+    }
+
 protected:
     // notify task which can be executed
     virtual void notify();
@@ -86,36 +200,80 @@ protected:
 
     bool hasIdleThreads() {return m_idleThreadCount > 0;}
 
-private:
-    template<typename FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool needNotify = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if (ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
-        }
-        
-        return needNotify;
-    }
+    // park the worker of current thread until a task is handed to it, it is
+    // picked by notify() or timeoutMs passes. it does not park when its own
+    // queues, the deque of a peer or the injection queue hold tasks, or when
+    // recheck() returns false once the worker is marked parked. false if
+    // timeoutMs passed without the worker being picked
+    bool parkWorker(int64_t timeoutMs, const std::function<bool()>& recheck = nullptr);
+
+    // how long an idle worker parks before it may retire, -1 unless elastic
+    int64_t retireTimeout() const;
+
+    // retire the worker of current thread if the pool is elastic and above
+    // its minimum, true if the idle coroutine should return to end the thread
+    bool tryRetire();
+
+    // wake one parked worker, false if none is parked
+    bool unparkOne();
+
+    // mark the worker of current thread as blocked in the poller, a task
+    // pinned to it then interrupts the poller by notifyPoller()
+    void setPolling(bool polling);
+
+    // tasks waiting in the queues current worker takes from first
+    bool hasPendingWork();
+
+    // tasks in the deque of any worker, a thief could take them
+    bool hasStealableWork();
+
+    // spin up to scheduler.spin_count rounds waiting for a task any worker
+    // could run, true if one showed up
+    bool spinForWork();
+
+    // interrupt the worker blocked in the poller
+    virtual void notifyPoller() {}
+
+    // count a parked worker woken by current thread
+    void countWakeup();
+
+    // count a poller interrupt asked for by current thread
+    void countNotify();
 
 private:
+    friend class TaskGroup;
+
     struct FiberAndThread {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Callable cb;
+        // stackless coroutine, resumed on the stack of the scheduling loop
+        std::coroutine_handle<> handle;
         int thread;
 
-        FiberAndThread(Fiber::ptr f, int thr):fiber{ f }, thread{ thr } {}
+        // link in the injection queue, a mailbox or a group queue
+        FiberAndThread* next = nullptr;
+
+        // group the task is accounted to, nullptr for none
+        TaskGroup* group = nullptr;
+
+        // when it was queued, 0 unless it is timed or grouped
+        uint64_t queuedUs = 0;
+
+        FiberAndThread(Fiber::ptr f, int thr):fiber{ std::move(f) }, thread{ thr } {}
 
         FiberAndThread(Fiber::ptr* f, int thr):thread{ thr } {
             fiber = std::move(*f);
         }
 
-        FiberAndThread(std::function<void()> f, int thr):cb{ f }, thread{ thr } {}
+        FiberAndThread(Callable&& f, int thr):cb{ std::move(f) }, thread{ thr } {}
 
-        FiberAndThread(std::function<void()>* f, int thr): thread{ thr } {
+        FiberAndThread(Callable* f, int thr): thread{ thr } {
             cb = std::move(*f);
         }
 
+        template<typename Promise>
+        FiberAndThread(std::coroutine_handle<Promise> h, int thr):handle{ h }, thread{ thr } {}
+
         FiberAndThread(): thread{ -1 } {
 
         }
@@ -123,31 +281,160 @@ private:
         void reset() {
             fiber = nullptr;
             cb = nullptr;
+            handle = nullptr;
             thread = -1;
+            next = nullptr;
+            group = nullptr;
+            queuedUs = 0;
         }
     };
 
+    // run queues of one thread of the pool, defined in scheduler.cpp
+    struct Worker;
+
+    // upper bound of task nodes each worker keeps for reuse
+    static const size_t FREE_TASK_MAX = 1024;
+
+    // most tasks a worker moves from the injection queue at once
+    static const size_t INJECT_BATCH = 32;
+
+    // a worker checks the injection queue first every this many tasks, so
+    // submissions from outside are not starved by busy local queues
+    static const uint32_t INJECT_INTERVAL = 61;
+
+    // queue a task: pinned ones go to the mailbox of their thread, the
+    // others to the local queue of the calling worker or the injection queue
+    void submit(FiberAndThread&& ft);
+
+    // queue count tasks chained by next, they share one lock and wakeup
+    void submitBatch(FiberAndThread* head, size_t count);
+
+    // route a counted task to its queue and wake a worker to run it
+    void enqueue(FiberAndThread* task);
+
+    // a task finished running, a grouped one is charged for the time since startUs
+    void taskDone(TaskGroup* group = nullptr, uint64_t startUs = 0);
+
+    // queue a task of a group
+    void enqueueGrouped(FiberAndThread* task);
+
+    // next task of the groups of priority by deficit round robin
+    FiberAndThread* takeGrouped(TaskPriority priority);
+
+    // cpu time in microseconds a group of weight 1 gets in a round
+    static const int64_t GROUP_QUANTUM_US = 1000;
+
+    // next task for worker, nullptr if there is nothing to run or steal
+    FiberAndThread* nextTask(Worker* worker);
+
+    // worker running on thread, nullptr if thread is not in the pool
+    Worker* workerOf(int thread);
+
+    // record the thread of worker in m_threadTable
+    void bindThread(Worker* worker, int thread);
+
+    // drop thread from m_threadTable
+    void unbindThread(int thread);
+
+    // size m_threadTable for the workers, bind the caller thread
+    void initThreadTable();
+
+    // start a pool thread running the worker of slot, m_mutex held
+    void spawnWorker(size_t slot);
+
+    // loop of the supervisor thread, resizes an elastic pool and runs the
+    // watchdog of scheduler.watchdog.budget_ms
+    void supervise();
+
+    // flag coroutines running longer than budgetUs to yield, log the
+    // backtrace of those still running after twice as long
+    void checkSlices(uint64_t budgetUs);
+
+    // SIGURG handler capturing the backtrace of the interrupted worker, a
+    // signal the watchdog did not request goes to the handler it replaced
+    static void onTraceSignal(int sig, siginfo_t* info, void* ctx);
+
+    // task nodes come from the cache of the current worker. a thread outside
+    // the pool has none, each task it schedules allocates its node and the
+    // worker running it keeps the node
+    FiberAndThread* allocTask();
+    void freeTask(FiberAndThread* task);
+
+    // worker of current thread
+    static thread_local Worker* t_worker;
+
 private:
     // mutex
     MutexType m_mutex;
 
-    // thread pool managed by scheduler
+    // thread pool managed by scheduler, by slot, nullptr for a slot of an
+    // elastic pool that is not running
     std::vector<Thread::ptr> m_threads;
 
-    // message queue storing either coroutine or functional obejct
-    std::list<FiberAndThread> m_fibers;
-    
+    // one worker per thread of the pool, plus the caller thread if used
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // open addressing table from thread id to worker, thread 0 marks an
+    // empty slot and -1 one whose thread retired
+    struct ThreadSlot {
+        std::atomic<int> thread{ 0 };
+        std::atomic<Worker*> worker{ nullptr };
+    };
+    std::unique_ptr<ThreadSlot[]> m_threadTable;
+    size_t m_threadTableMask = 0;
+
+    // tasks submitted from threads outside the pool, guarded by m_mutex
+    FiberAndThread* m_injectHead = nullptr;
+    FiberAndThread* m_injectTail = nullptr;
+    std::atomic<size_t> m_injectSize{ 0 };
+
+    // tasks queued or running, the scheduler is not stopped until it drops to zero
+    std::atomic<size_t> m_pendingTasks{ 0 };
+
     // pointer to main coroutine
     Fiber::ptr m_rootFiber;
 
     // name of scheduler
     std::string m_name;
 
+    // cpus each slot of the pool is pinned to, planned by start()
+    std::vector<std::vector<int>> m_affinity;
+
+    // pool size adapts between m_minThreads and m_threadCount
+    bool m_elastic = false;
+    size_t m_minThreads = 0;
+
+    // threads of the pool running, retiring ones excluded
+    std::atomic<size_t> m_liveThreads{ 0 };
+
+    // thread resizing an elastic pool and watching for long slices
+    Thread::ptr m_supervisor;
+    Parker m_supervisorParker;
+
+    // task groups and their queues, guarded by m_groupMutex
+    Spinlock m_groupMutex;
+    std::vector<std::shared_ptr<TaskGroup>> m_groups;
+
+    // groups of each priority class and the one served last
+    std::vector<TaskGroup*> m_groupClasses[2];
+    size_t m_groupCursor[2] = { 0, 0 };
+
+    // queued tasks of the groups of each priority class
+    std::atomic<size_t> m_groupQueued[2] = { 0, 0 };
+
+    // wakeups and notifies from threads outside the pool, the others count
+    // per worker
+    std::atomic<uint64_t> m_externalWakeups{ 0 };
+    std::atomic<uint64_t> m_externalNotifies{ 0 };
+
+    // when start() was called, in milliseconds
+    uint64_t m_startMs = 0;
+
 protected:
     // a list of thread id in thread pool
     std::vector<int> m_threadIds;
     
-    // number of threads in thread pool
+    // number of threads in thread pool, the upper bound of an elastic one
     size_t m_threadCount{ 0 };
 
     // number of active thread
@@ -157,15 +444,93 @@ protected:
     std::atomic<size_t> m_idleThreadCount{ 0 };
     
     // if scheduler is stopped
-    bool m_isRunning{ false };
+    std::atomic<bool> m_isRunning{ false };
     
     // flag to determine if scheduler is stopped by stop()
-    bool m_autoStop{ false };
+    std::atomic<bool> m_autoStop{ false };
 
     // main thread id
     int m_rootThread{ 0 };   
 };
 
+// run the coroutine on another scheduler for the lifetime of the switcher,
+// it goes back to the scheduler it came from on destruction, e.g.
+//   SchedulerSwitcher sw(cpuPool);
+//   compress(buf);
+class SchedulerSwitcher {
+public:
+    explicit SchedulerSwitcher(Scheduler* target = nullptr);
+    ~SchedulerSwitcher();
+
+    SchedulerSwitcher(const SchedulerSwitcher&) = delete;
+    SchedulerSwitcher& operator=(const SchedulerSwitcher&) = delete;
+
+private:
+    Scheduler* m_caller;
+};
+
+// tasks of one tenant or kind of work on a scheduler, created by
+// Scheduler::addGroup and kept as long as the scheduler
+class TaskGroup {
+public:
+    using ptr = std::shared_ptr<TaskGroup>;
+
+    struct Stats {
+        // tasks waiting in the queue
+        size_t queued = 0;
+
+        // tasks taken from the queue so far
+        uint64_t dispatched = 0;
+
+        // time the dispatched tasks waited in the queue, in total and at most
+        uint64_t waitUs = 0;
+        uint64_t maxWaitUs = 0;
+
+        // cpu time the group was charged
+        uint64_t runUs = 0;
+
+        uint64_t avgWaitUs() const { return dispatched ? waitUs / dispatched : 0; }
+    };
+
+    Scheduler* getScheduler() const { return m_scheduler; }
+
+    const std::string& getName() const { return m_name; }
+
+    uint32_t getWeight() const { return m_weight; }
+
+    TaskPriority getPriority() const { return m_priority; }
+
+    // tasks waiting in the queue
+    size_t getQueueDepth() const { return m_queued; }
+
+    Stats getStats() const;
+
+private:
+    friend class Scheduler;
+
+    TaskGroup(Scheduler* scheduler, const std::string& name, uint32_t weight, TaskPriority priority);
+
+private:
+    Scheduler* m_scheduler;
+    std::string m_name;
+    uint32_t m_weight;
+    TaskPriority m_priority;
+
+    // fifo of queued tasks, guarded by Scheduler::m_groupMutex
+    Scheduler::FiberAndThread* m_head = nullptr;
+    Scheduler::FiberAndThread* m_tail = nullptr;
+
+    // microseconds the group may still run in this round, charged after
+    // each task, so it goes negative when a task overruns
+    std::atomic<int64_t> m_deficit{ 0 };
+
+    std::atomic<size_t> m_queued{ 0 };
+    std::atomic<uint64_t> m_dispatched{ 0 };
+    std::atomic<uint64_t> m_waitUs{ 0 };
+    std::atomic<uint64_t> m_maxWaitUs{ 0 };
+    std::atomic<uint64_t> m_runUs{ 0 };
+};
+
 
 
 
@@ -0,0 +1,247 @@
+#ifndef __SERVER_TASK_HPP__
+#define __SERVER_TASK_HPP__
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "iomanager.hpp"
+#include "log.hpp"
+#include "macro.hpp"
+
+namespace Server {
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+    // awaiting coroutine, resumed when the task finishes
+    std::coroutine_handle<> continuation;
+
+    std::exception_ptr exception;
+
+    // tasks are lazy, they start when awaited or spawned
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        // symmetric transfer to the awaiting coroutine, no stack growth
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    void rethrow() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+    T result() {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() { rethrow(); }
+};
+
+// self-destroying coroutine that owns a spawned task
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept {
+            return DetachedTask{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+}
+
+// stackless C++20 coroutine returning T, its frame is allocated on the heap
+// and sized to the locals that live across suspension points. a Task does
+// not run until it is awaited by another coroutine or passed to spawn().
+// it runs on the stack of whoever resumes it, so it must not block the
+// thread or call Fiber::yieldToHold/yieldToReady
+template<typename T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() noexcept = default;
+
+    explicit Task(handle_type h) noexcept : m_handle{ h } {}
+
+    Task(Task&& other) noexcept : m_handle{ std::exchange(other.m_handle, nullptr) } {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool done() const { return !m_handle || m_handle.done(); }
+
+    // start the task from the awaiting coroutine and return its result
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            handle_type handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+
+        return Awaiter{ m_handle };
+    }
+
+private:
+    handle_type m_handle;
+};
+
+namespace detail {
+
+template<typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>{ std::coroutine_handle<TaskPromise<T>>::from_promise(*this) };
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>{ std::coroutine_handle<TaskPromise<void>>::from_promise(*this) };
+}
+
+inline DetachedTask runDetached(Task<void> task) {
+    try {
+        co_await std::move(task);
+    } catch (std::exception& e) {
+        SERVER_LOG_ERROR(SERVER_LOG_NAME("system")) << "Task Exception: " << e.what();
+    } catch (...) {
+        SERVER_LOG_ERROR(SERVER_LOG_NAME("system")) << "Task Exception";
+    }
+}
+
+}
+
+// run a task on scheduler without waiting for it, the task frame is
+// freed when it finishes, exceptions escaping it are logged
+inline void spawn(Task<void> task, Scheduler* scheduler = Scheduler::getThis()) {
+    SERVER_ASSERT_INFO(scheduler, "spawn needs a scheduler");
+    scheduler->schedule(detail::runDetached(std::move(task)).handle);
+}
+
+// co_await scheduleOn(sc) moves the rest of the coroutine onto a thread of sc
+class ScheduleOnAwaiter {
+public:
+    explicit ScheduleOnAwaiter(Scheduler* scheduler) : m_scheduler{ scheduler } {}
+
+    bool await_ready() const noexcept { return Scheduler::getThis() == m_scheduler; }
+
+    void await_suspend(std::coroutine_handle<> h) { m_scheduler->schedule(h); }
+
+    void await_resume() const noexcept {}
+
+private:
+    Scheduler* m_scheduler;
+};
+
+inline ScheduleOnAwaiter scheduleOn(Scheduler* scheduler) {
+    return ScheduleOnAwaiter{ scheduler };
+}
+
+// suspend until fd is ready for event on the current IOManager, resumes
+// with true once the event fires or is cancelled, false if it cannot be added
+class IOEventAwaiter {
+public:
+    IOEventAwaiter(int fd, IOManager::Event event) : m_fd{ fd }, m_event{ event } {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::getThis();
+        SERVER_ASSERT_INFO(iom, "waiting for fd needs an IOManager");
+
+        // once the event is added the coroutine may be resumed on another
+        // thread, so members are not touched after a successful addEvent
+        m_added = true;
+        if (iom->addEvent(m_fd, m_event, h)) {
+            m_added = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool await_resume() const noexcept { return m_added; }
+
+private:
+    int m_fd;
+    IOManager::Event m_event;
+    bool m_added = false;
+};
+
+inline IOEventAwaiter waitReadable(int fd) {
+    return IOEventAwaiter{ fd, IOManager::READ };
+}
+
+inline IOEventAwaiter waitWritable(int fd) {
+    return IOEventAwaiter{ fd, IOManager::WRITE };
+}
+
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "thread.hpp"
+#include <sched.h>
+#include <string.h>
 #include "log.hpp"
 #include "util.hpp"
 
@@ -31,6 +33,24 @@ void Thread::setName(const std::string& name) {
     t_thread_name = name;
 };
 
+bool Thread::setAffinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret) {
+        SERVER_LOG_ERROR(g_logger) << "pthread_setaffinity_np failed, ret = " << ret
+                                    << " (" << strerror(ret) << ") name = " << t_thread_name;
+        return false;
+    }
+    return true;
+};
+
 Thread::Thread(std::function<void()> cb, const std::string& name)
     :m_cb{ cb }
     , m_name{ name } {
@@ -6,6 +6,8 @@
 #include <memory>
 #include <pthread.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "mutex.hpp"
 
@@ -34,6 +36,9 @@ public:
     // Set thread name of current thread
     static void setName(const std::string& name);
 
+    // restrict current thread to cpus, false if the kernel refuses
+    static bool setAffinity(const std::vector<int>& cpus);
+
 private:
     Thread(const Thread&) = delete;
     Thread(const Thread&&) = delete;
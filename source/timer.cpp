@@ -0,0 +1,314 @@
+#include "timer.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+
+namespace Server {
+
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
+    : m_recurring{ recurring },
+    m_ms{ ms },
+    m_cb{ std::move(cb) },
+    m_manager{ manager } {
+}
+
+bool Timer::cancel() {
+    Timer::ptr self;
+    {
+        Mutex::Lock lock(m_manager->m_mutex);
+        if (!m_self) {
+            return false;
+        }
+
+        m_manager->unlink(this);
+        --m_manager->m_count;
+        m_cb = nullptr;
+        // drop the queue's reference after the lock
+        self.swap(m_self);
+    }
+    return true;
+}
+
+bool Timer::refresh() {
+    Mutex::Lock lock(m_manager->m_mutex);
+    if (!m_self) {
+        return false;
+    }
+
+    // the deadline only moves later, no need to wake the poller
+    m_manager->unlink(this);
+    m_deadline = m_manager->getNowMS() + m_ms;
+    m_manager->link(this);
+    return true;
+}
+
+bool Timer::reset(uint64_t ms, bool fromNow) {
+    if (ms == m_ms && !fromNow) {
+        return true;
+    }
+
+    bool front = false;
+    {
+        Mutex::Lock lock(m_manager->m_mutex);
+        if (!m_self) {
+            return false;
+        }
+
+        m_manager->unlink(this);
+        uint64_t start = fromNow ? m_manager->getNowMS() : m_deadline - m_ms;
+        m_ms = ms;
+        m_deadline = start + m_ms;
+        front = m_manager->link(this);
+    }
+
+    if (front) {
+        m_manager->onTimerInsertedAtFront();
+    }
+    return true;
+}
+
+TimerManager::TimerManager() {
+    m_slots[0].resize(ROOT_SLOTS);
+    for (int level = 1; level < LEVELS; ++level) {
+        m_slots[level].resize(LEVEL_SLOTS);
+    }
+}
+
+TimerManager::~TimerManager() {
+    std::vector<Timer::ptr> timers;
+    {
+        Mutex::Lock lock(m_mutex);
+        for (auto& slots : m_slots) {
+            for (auto& s : slots) {
+                for (Timer* t = s.head; t; t = t->m_next) {
+                    timers.push_back(std::move(t->m_self));
+                }
+                s.head = s.tail = nullptr;
+            }
+        }
+        m_count = 0;
+    }
+}
+
+uint64_t TimerManager::getNowMS() {
+    return getCurrentMS();
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    uint64_t now = getNowMS();
+
+    bool front = false;
+    {
+        Mutex::Lock lock(m_mutex);
+        // an empty wheel has nothing between its tick and now to process
+        if (!m_count) {
+            m_current = now;
+        }
+
+        timer->m_deadline = now + ms;
+        timer->m_self = timer;
+        ++m_count;
+        front = link(timer.get());
+    }
+
+    if (front) {
+        onTimerInsertedAtFront();
+    }
+    return timer;
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+                                           std::weak_ptr<void> cond, bool recurring) {
+    return addTimer(ms, [cond, cb]() {
+        if (cond.lock()) {
+            cb();
+        }
+    }, recurring);
+}
+
+bool TimerManager::link(Timer* t) {
+    uint64_t deadline = std::max(t->m_deadline, m_current);
+    uint64_t delta = deadline - m_current;
+
+    // pick the lowest level whose range holds the deadline
+    int level = 0;
+    if (delta >= ROOT_SLOTS) {
+        level = 1;
+        while (level < LEVELS - 1 && delta >> levelShift(level + 1)) {
+            ++level;
+        }
+
+        // beyond the wheel, wait in its farthest slot and get queued again there
+        uint64_t range = 1ull << (levelShift(LEVELS - 1) + LEVEL_BITS);
+        if (delta >= range) {
+            deadline = m_current + range - 1;
+        }
+    }
+
+    uint64_t mask = (level ? LEVEL_SLOTS : ROOT_SLOTS) - 1;
+    uint64_t index = (deadline >> levelShift(level)) & mask;
+
+    Slot& s = slot(level, index);
+    t->m_level = level;
+    t->m_index = index;
+    t->m_prev = s.tail;
+    t->m_next = nullptr;
+    if (s.tail) {
+        s.tail->m_next = t;
+    } else {
+        s.head = t;
+    }
+    s.tail = t;
+    m_occupied[level][index / 64] |= 1ull << (index % 64);
+
+    if (t->m_deadline < m_nextWake) {
+        m_nextWake = t->m_deadline;
+        return true;
+    }
+    return false;
+}
+
+void TimerManager::unlink(Timer* t) {
+    Slot& s = slot(t->m_level, t->m_index);
+    if (t->m_prev) {
+        t->m_prev->m_next = t->m_next;
+    } else {
+        s.head = t->m_next;
+    }
+
+    if (t->m_next) {
+        t->m_next->m_prev = t->m_prev;
+    } else {
+        s.tail = t->m_prev;
+    }
+    t->m_prev = t->m_next = nullptr;
+
+    if (!s.head) {
+        m_occupied[t->m_level][t->m_index / 64] &= ~(1ull << (t->m_index % 64));
+    }
+}
+
+void TimerManager::cascade(int level, uint64_t index) {
+    Slot& s = slot(level, index);
+    Timer* t = s.head;
+    s.head = s.tail = nullptr;
+    m_occupied[level][index / 64] &= ~(1ull << (index % 64));
+
+    while (t) {
+        Timer* next = t->m_next;
+        link(t);
+        t = next;
+    }
+}
+
+uint64_t TimerManager::nextSlotDistance(int level, uint64_t skip) {
+    uint64_t slots = level ? LEVEL_SLOTS : ROOT_SLOTS;
+    uint64_t current = (m_current >> levelShift(level)) + skip;
+    for (uint64_t d = 0; d < slots;) {
+        uint64_t i = (current + d) & (slots - 1);
+        uint64_t word = m_occupied[level][i / 64] >> (i % 64);
+        if (word) {
+            return skip + d + __builtin_ctzll(word);
+        }
+        d += 64 - i % 64;
+    }
+    return ~0ull;
+}
+
+uint64_t TimerManager::getNextTimer() {
+    uint64_t now = getNowMS();
+    Mutex::Lock lock(m_mutex);
+    if (!m_count) {
+        m_nextWake = ~0ull;
+        return ~0ull;
+    }
+
+    // the next tick with a due slot on the lowest level
+    uint64_t next = ~0ull;
+    uint64_t d = nextSlotDistance(0, 0);
+    if (d != ~0ull) {
+        next = m_current + d;
+    }
+
+    // the next tick moving an upper slot down, the current slot of a level
+    // only moves again a full turn later unless its tick is still to come
+    for (int level = 1; level < LEVELS; ++level) {
+        int shift = levelShift(level);
+        uint64_t skip = (m_current & ((1ull << shift) - 1)) ? 1 : 0;
+        d = nextSlotDistance(level, skip);
+        if (d != ~0ull) {
+            next = std::min(next, ((m_current >> shift) + d) << shift);
+        }
+    }
+    m_nextWake = next;
+    return next > now ? next - now : 0;
+}
+
+void TimerManager::listExpiredCb(std::vector<Callable>& cbs) {
+    uint64_t now = getNowMS();
+    std::vector<Timer::ptr> expired;
+
+    Mutex::Lock lock(m_mutex);
+    while (m_count && m_current <= now) {
+        uint64_t index = m_current & (ROOT_SLOTS - 1);
+        if (index == 0) {
+            // a level moves down when the ticks of all levels below wrap
+            for (int level = 1; level < LEVELS; ++level) {
+                uint64_t i = (m_current >> levelShift(level)) & (LEVEL_SLOTS - 1);
+                cascade(level, i);
+                if (i) {
+                    break;
+                }
+            }
+        }
+
+        Slot& s = slot(0, index);
+        Timer* t = s.head;
+        s.head = s.tail = nullptr;
+        m_occupied[0][index / 64] &= ~(1ull << (index % 64));
+
+        while (t) {
+            Timer* next = t->m_next;
+            t->m_prev = t->m_next = nullptr;
+            if (t->m_recurring) {
+                cbs.emplace_back(t->m_cb);
+                // the slot of this tick is being emptied, queue at least one tick later
+                t->m_deadline = now + std::max<uint64_t>(t->m_ms, 1);
+                link(t);
+            } else {
+                cbs.emplace_back(std::move(t->m_cb));
+                t->m_cb = nullptr;
+                --m_count;
+                expired.push_back(std::move(t->m_self));
+            }
+            t = next;
+        }
+        ++m_current;
+
+        // nothing due on the lowest level, skip to where the next upper slot moves down
+        bool empty = true;
+        for (uint64_t word : m_occupied[0]) {
+            empty = empty && !word;
+        }
+        if (empty && (m_current & (ROOT_SLOTS - 1))) {
+            m_current = std::min((m_current | (ROOT_SLOTS - 1)) + 1, now + 1);
+        }
+    }
+
+    if (!m_count && m_current <= now) {
+        m_current = now + 1;
+    }
+}
+
+bool TimerManager::hasTimer() {
+    Mutex::Lock lock(m_mutex);
+    return m_count > 0;
+}
+
+size_t TimerManager::getTimerCount() {
+    Mutex::Lock lock(m_mutex);
+    return m_count;
+}
+
+}
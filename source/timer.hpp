@@ -0,0 +1,144 @@
+#ifndef __SERVER_TIMER_HPP__
+#define __SERVER_TIMER_HPP__
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "callable.hpp"
+#include "mutex.hpp"
+
+namespace Server {
+
+class TimerManager;
+
+// a callback due at a deadline in ms, made by TimerManager::addTimer
+class Timer : public std::enable_shared_from_this<Timer> {
+    friend class TimerManager;
+public:
+    using ptr = std::shared_ptr<Timer>;
+
+    // remove the timer before it fires, false if it already fired or was cancelled
+    bool cancel();
+
+    // start the period again from now
+    bool refresh();
+
+    // change the period to ms, counted from now or from the last start
+    bool reset(uint64_t ms, bool fromNow);
+
+    uint64_t getPeriod() const { return m_ms; }
+    bool isRecurring() const { return m_recurring; }
+
+private:
+    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+
+private:
+    bool m_recurring = false;
+
+    // period in ms
+    uint64_t m_ms = 0;
+
+    // absolute deadline in ms
+    uint64_t m_deadline = 0;
+
+    std::function<void()> m_cb;
+    TimerManager* m_manager = nullptr;
+
+    // links of the wheel slot holding the timer, m_self keeps a queued
+    // timer alive when its owner drops it
+    int m_level = 0;
+    uint64_t m_index = 0;
+    Timer* m_prev = nullptr;
+    Timer* m_next = nullptr;
+    Timer::ptr m_self;
+};
+
+// timers kept in a hierarchical timing wheel of 1ms ticks: 256 slots for
+// the next 256ms, then four levels of 64 slots each covering 64 times the
+// range of the level below. adding and cancelling a timer is O(1), a timer
+// of an upper level moves down a level each time the ticks reach its slot
+class TimerManager {
+    friend class Timer;
+public:
+    TimerManager();
+
+    virtual ~TimerManager();
+
+    // call cb ms from now, every ms if recurring
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+
+    // like addTimer, but cb is skipped once cond has expired
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+                                 std::weak_ptr<void> cond, bool recurring = false);
+
+    // ms until the wheel has to advance, 0 if a timer is due and ~0ull if
+    // there is none. may be early for timers of an upper level, which only
+    // move down then
+    uint64_t getNextTimer();
+
+    // advance the wheel to now and collect the callbacks of expired timers
+    void listExpiredCb(std::vector<Callable>& cbs);
+
+    bool hasTimer();
+
+    size_t getTimerCount();
+
+protected:
+    // a timer was added before the deadline getNextTimer() reported, the
+    // thread waiting for it has to wake up earlier
+    virtual void onTimerInsertedAtFront() {}
+
+    // clock of the wheel in ms
+    virtual uint64_t getNowMS();
+
+private:
+    // slots of the lowest level, the others have LEVEL_SLOTS
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 5;
+    static const uint64_t ROOT_SLOTS = 1 << ROOT_BITS;
+    static const uint64_t LEVEL_SLOTS = 1 << LEVEL_BITS;
+
+    struct Slot {
+        Timer* head = nullptr;
+        Timer* tail = nullptr;
+    };
+
+    // queue t by its deadline, returns true if it is due before the
+    // deadline last reported by getNextTimer()
+    bool link(Timer* t);
+
+    void unlink(Timer* t);
+
+    // move the timers of a slot of an upper level down
+    void cascade(int level, uint64_t index);
+
+    // shift of the tick bits indexing the slots of level
+    static int levelShift(int level) { return level ? ROOT_BITS + (level - 1) * LEVEL_BITS : 0; }
+
+    Slot& slot(int level, uint64_t index) { return m_slots[level][index]; }
+
+    // slots from the current one of level, skipping the first skip of
+    // them, to the next non-empty slot, ~0ull if the level is empty
+    uint64_t nextSlotDistance(int level, uint64_t skip);
+
+private:
+    Mutex m_mutex;
+
+    // next tick to process
+    uint64_t m_current = 0;
+    size_t m_count = 0;
+
+    // deadline reported by getNextTimer(), an earlier timer notifies
+    uint64_t m_nextWake = ~0ull;
+
+    std::vector<Slot> m_slots[LEVELS];
+
+    // one bit per non-empty slot, ROOT_SLOTS bits for the lowest level
+    uint64_t m_occupied[LEVELS][ROOT_SLOTS / 64] = {};
+};
+
+}
+
+#endif
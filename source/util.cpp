@@ -1,4 +1,8 @@
 #include <execinfo.h>
+#include <ctype.h>
+#include <fstream>
+#include <sstream>
+#include <time.h>
 
 #include "util.hpp"
 #include "log.hpp"
@@ -8,14 +12,41 @@ namespace Server {
 
 Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
+// gettid of current thread, 0 until first asked. a thread keeps its id,
+// only the child of fork() has to ask again
+static thread_local pid_t t_threadId{ 0 };
+
+struct ThreadIdIniter {
+    ThreadIdIniter() {
+        pthread_atfork(nullptr, nullptr, []() { t_threadId = 0; });
+    }
+};
+
+static ThreadIdIniter s_threadIdIniter;
+
 pid_t getThreadId(){
-    return syscall(SYS_gettid);
+    if (!t_threadId) {
+        t_threadId = syscall(SYS_gettid);
+    }
+    return t_threadId;
 };
 
 uint32_t getFiberId(){
     return Server::Fiber::getFiberId();
 };
 
+uint64_t getCurrentMS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+uint64_t getCurrentUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 void Backtrace(std::vector<std::string>& bt, int size, int skip){
     void** array = (void**)malloc((sizeof(void*) * size));
 
@@ -51,4 +82,56 @@ std::string BacktraceToString(int size, int skip, const std::string& prefix){
     return ss.str();
 };
 
-}
\ No newline at end of file
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || !isdigit(range[0])) {
+            continue;
+        }
+
+        int first = atoi(range.c_str());
+        size_t dash = range.find('-');
+        int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// first line of a sysfs file, empty if it cannot be read
+static std::string readSysfs(const std::string& path) {
+    std::ifstream ifs(path);
+    std::string line;
+    std::getline(ifs, line);
+    return line;
+}
+
+std::vector<int> getOnlineCpus() {
+    std::vector<int> cpus = parseCpuList(readSysfs("/sys/devices/system/cpu/online"));
+    if (cpus.empty()) {
+        // no sysfs, assume the configured cpus are all online
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long i = 0; i < n; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> getNodeCpus(int node) {
+    return parseCpuList(readSysfs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+std::vector<int> getCoreSiblings(int cpu) {
+    std::vector<int> cpus = parseCpuList(readSysfs("/sys/devices/system/cpu/cpu"
+                                        + std::to_string(cpu) + "/topology/thread_siblings_list"));
+    if (cpus.empty()) {
+        cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+}
@@ -17,12 +17,30 @@ pid_t getThreadId();
 // Get coroutine id from kernel
 uint32_t getFiberId();
 
+// milliseconds of a monotonic clock, for measuring intervals
+uint64_t getCurrentMS();
+
+// microseconds of the same clock
+uint64_t getCurrentUS();
+
 // Get stack frames
 void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
 
 // Get info of stack frames
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
 
+// cpus of a list in sysfs format, e.g. "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string& list);
+
+// cpus currently online
+std::vector<int> getOnlineCpus();
+
+// cpus of a NUMA node, empty if the node does not exist
+std::vector<int> getNodeCpus(int node);
+
+// hardware threads sharing the physical core of cpu, cpu included
+std::vector<int> getCoreSiblings(int cpu);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef __SERVER_WORK_QUEUE_HPP__
+#define __SERVER_WORK_QUEUE_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+namespace Server {
+
+// Chase-Lev work-stealing queue of trivially copyable values (task pointers).
+// only the owner thread pushes at the bottom; any thread, the owner included,
+// takes from the top with a CAS, so values leave in the order they were pushed.
+// the ring grows when full, replaced rings are kept until destruction because
+// a concurrent thief may still be reading one
+template<typename T>
+class WorkStealingQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingQueue holds trivially copyable values");
+
+public:
+    // capacity: initial ring size, rounded up to a power of two
+    explicit WorkStealingQueue(size_t capacity = 256) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_ring.store(new Ring(size, nullptr), std::memory_order_relaxed);
+    }
+
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    ~WorkStealingQueue() {
+        Ring* ring = m_ring.load(std::memory_order_relaxed);
+        while (ring) {
+            Ring* prev = ring->prev;
+            delete ring;
+            ring = prev;
+        }
+    }
+
+    // append a value, owner thread only
+    void push(T value) {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_acquire);
+        Ring* ring = m_ring.load(std::memory_order_relaxed);
+
+        if (bottom - top > ring->mask) {
+            ring = grow(ring, top, bottom);
+        }
+
+        ring->put(bottom, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // take the oldest value, false if the queue is empty
+    bool steal(T& value) {
+        while (true) {
+            int64_t top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = m_bottom.load(std::memory_order_acquire);
+            if (top >= bottom) {
+                return false;
+            }
+
+            T v = m_ring.load(std::memory_order_acquire)->get(top);
+            if (m_top.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                value = v;
+                return true;
+            }
+            // lost the race for this slot, try the next one
+        }
+    }
+
+    // approximate number of values, exact on the owner thread without thieves
+    size_t size() const {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+        return bottom > top ? bottom - top : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Ring {
+        Ring(size_t size, Ring* p)
+            : mask{ static_cast<int64_t>(size) - 1 },
+            slots{ new std::atomic<T>[size] },
+            prev{ p } {
+        }
+
+        ~Ring() { delete[] slots; }
+
+        T get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+
+        void put(int64_t i, T v) { slots[i & mask].store(v, std::memory_order_relaxed); }
+
+        int64_t mask;
+        std::atomic<T>* slots;
+
+        // ring replaced by this one
+        Ring* prev;
+    };
+
+    // double the ring, values keep their indices
+    Ring* grow(Ring* ring, int64_t top, int64_t bottom) {
+        Ring* bigger = new Ring(2 * (ring->mask + 1), ring);
+        for (int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, ring->get(i));
+        }
+        m_ring.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+private:
+    // owner and thieves write different ends, keep them on separate cache lines
+    alignas(64) std::atomic<int64_t> m_top{ 0 };
+    alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+    std::atomic<Ring*> m_ring;
+};
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+#include "source/headers.hpp"
+
+#include <chrono>
+#include <stdlib.h>
+#include <ucontext.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const size_t STACK_SIZE = 128 * 1024;
+
+// ucontext ping-pong
+static ucontext_t s_mainCtx;
+static ucontext_t s_coCtx;
+
+static void ucontextFunc() {
+    while (true) {
+        swapcontext(&s_coCtx, &s_mainCtx);
+    }
+}
+
+// switches per second of swapcontext (one iteration is two switches)
+double bench_ucontext(uint64_t n) {
+    void* stack = malloc(STACK_SIZE);
+    getcontext(&s_coCtx);
+    s_coCtx.uc_link = nullptr;
+    s_coCtx.uc_stack.ss_sp = stack;
+    s_coCtx.uc_stack.ss_size = STACK_SIZE;
+    makecontext(&s_coCtx, &ucontextFunc, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; ++i) {
+        swapcontext(&s_mainCtx, &s_coCtx);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    free(stack);
+    return 2 * n / elapsed.count();
+}
+
+#if SERVER_HAS_FCONTEXT
+// fcontext ping-pong
+static void* s_mainSp = nullptr;
+static void* s_coSp = nullptr;
+
+static void fcontextFunc() {
+    while (true) {
+        server_jump_fcontext(&s_coSp, s_mainSp);
+    }
+}
+
+// switches per second of the assembly switch
+double bench_fcontext(uint64_t n) {
+    void* stack = malloc(STACK_SIZE);
+    s_coSp = Server::makeFContext(stack, STACK_SIZE, &fcontextFunc);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; ++i) {
+        server_jump_fcontext(&s_mainSp, s_coSp);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    free(stack);
+    return 2 * n / elapsed.count();
+}
+#endif
+
+// switches per second of Fiber::swapIn/yieldToHold with the configured backend
+double bench_fiber(uint64_t n) {
+    Server::Fiber::getThis();
+    Server::Fiber::ptr fiber = std::make_shared<Server::Fiber>([n](){
+        for (uint64_t i = 0; i < n; ++i) {
+            Server::Fiber::yieldToHold();
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; ++i) {
+        fiber->swapIn();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // let the coroutine finish
+    fiber->swapIn();
+    return 2 * n / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+
+    SERVER_LOG_INFO(g_logger) << "iterations: " << n;
+    SERVER_LOG_INFO(g_logger) << "ucontext: " << static_cast<uint64_t>(bench_ucontext(n)) << " switches/s";
+#if SERVER_HAS_FCONTEXT
+    SERVER_LOG_INFO(g_logger) << "fcontext: " << static_cast<uint64_t>(bench_fcontext(n)) << " switches/s";
+#endif
+    SERVER_LOG_INFO(g_logger) << "Fiber (" << Server::Fiber::getContextBackend() << "): "
+                            << static_cast<uint64_t>(bench_fiber(n)) << " switches/s";
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "source/headers.hpp"
+
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// resident set size of the process in bytes
+size_t rss() {
+    size_t pages = 0;
+    size_t resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// a connection handler parked on its first read
+void parked() {
+    volatile char buf[256];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        buf[i] = static_cast<char>(i);
+    }
+    Server::Fiber::yieldToHold();
+    (void)buf[0];
+}
+
+// bytes of RSS per parked coroutine
+size_t bench_park(size_t n, Server::Fiber::StackMode mode) {
+    std::vector<Server::Fiber::ptr> fibers;
+    fibers.reserve(n);
+
+    size_t before = rss();
+    for (size_t i = 0; i < n; ++i) {
+        Server::Fiber::ptr fiber = std::make_shared<Server::Fiber>(&parked, 0, false, mode);
+        fiber->swapIn();
+        fibers.push_back(fiber);
+    }
+    size_t after = rss();
+
+    // resume all coroutines so they terminate
+    for (auto& i : fibers) {
+        i->swapIn();
+    }
+
+    return after > before ? (after - before) / n : 0;
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000;
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    Server::Fiber::getThis();
+
+    SERVER_LOG_INFO(g_logger) << "parked fibers: " << n;
+    SERVER_LOG_INFO(g_logger) << "private stack: "
+                            << bench_park(n, Server::Fiber::StackMode::PRIVATE) << " bytes/fiber";
+    SERVER_LOG_INFO(g_logger) << "shared stack: "
+                            << bench_park(n, Server::Fiber::StackMode::SHARED) << " bytes/fiber";
+
+    return 0;
+}
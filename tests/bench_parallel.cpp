@@ -0,0 +1,71 @@
+#include "source/headers.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <stdlib.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// a few hundred nanoseconds of work per element
+static double work(size_t i) {
+    double x = static_cast<double>(i);
+    for (int k = 0; k < 16; ++k) {
+        x = std::sqrt(x + k);
+    }
+    return x;
+}
+
+// elements per second when every element is its own task
+double bench_naive(Server::Scheduler& sc, std::vector<double>& out) {
+    size_t n = out.size();
+    Server::WaitGroup wg(n);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        sc.schedule([&out, &wg, i]() {
+            out[i] = work(i);
+            wg.done();
+        });
+    }
+    wg.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return n / elapsed.count();
+}
+
+// elements per second of parallelFor over the same loop
+double bench_for(Server::Scheduler& sc, std::vector<double>& out) {
+    size_t n = out.size();
+    auto start = std::chrono::steady_clock::now();
+    Server::parallelFor(&sc, static_cast<size_t>(0), n, [&out](size_t i) { out[i] = work(i); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return n / elapsed.count();
+}
+
+// elements per second of parallelReduce summing the loop
+double bench_reduce(Server::Scheduler& sc, size_t n) {
+    auto start = std::chrono::steady_clock::now();
+    double sum = Server::parallelReduce(&sc, static_cast<size_t>(0), n, 0.0, work,
+                                        [](double a, double b) { return a + b; });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    SERVER_ASSERT(sum > 0);
+    return n / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t maxThreads = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64;
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+
+    SERVER_LOG_INFO(g_logger) << "elements: " << n;
+    std::vector<double> out(n);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        Server::Scheduler sc(threads, false, "bench");
+        sc.start();
+        SERVER_LOG_INFO(g_logger) << "threads: " << threads
+                                << " naive: " << static_cast<uint64_t>(bench_naive(sc, out)) << " elems/s"
+                                << " parallelFor: " << static_cast<uint64_t>(bench_for(sc, out)) << " elems/s"
+                                << " parallelReduce: " << static_cast<uint64_t>(bench_reduce(sc, n)) << " elems/s";
+        sc.stop();
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "source/headers.hpp"
+
+#include <chrono>
+#include <stdlib.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// tasks per second when a thread outside the pool submits every task
+double bench_external(size_t threads, uint64_t n) {
+    Server::Scheduler sc(threads, false, "bench");
+    sc.start();
+
+    Server::WaitGroup wg(n);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([&wg]() { wg.done(); });
+    }
+    wg.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    sc.stop();
+    return n / elapsed.count();
+}
+
+// every task submits two children until depth runs out, so the work is
+// produced on the workers themselves and spread by stealing
+static void spawnTree(Server::Scheduler* sc, Server::WaitGroup* wg, int depth) {
+    if (depth > 0) {
+        sc->schedule([sc, wg, depth]() { spawnTree(sc, wg, depth - 1); });
+        sc->schedule([sc, wg, depth]() { spawnTree(sc, wg, depth - 1); });
+    }
+    wg->done();
+}
+
+// tasks per second of a spawn tree with at least n tasks
+double bench_spawn(size_t threads, uint64_t n) {
+    int depth = 0;
+    while ((2ULL << depth) - 1 < n) {
+        ++depth;
+    }
+    uint64_t total = (2ULL << depth) - 1;
+
+    Server::Scheduler sc(threads, false, "bench");
+    sc.start();
+
+    Server::WaitGroup wg(total);
+    auto start = std::chrono::steady_clock::now();
+    sc.schedule([&sc, &wg, depth]() { spawnTree(&sc, &wg, depth); });
+    wg.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    sc.stop();
+    return total / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t maxThreads = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64;
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+
+    SERVER_LOG_INFO(g_logger) << "tasks: " << n;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        SERVER_LOG_INFO(g_logger) << "threads: " << threads
+                                << " external: " << static_cast<uint64_t>(bench_external(threads, n)) << " tasks/s"
+                                << " spawn: " << static_cast<uint64_t>(bench_spawn(threads, n)) << " tasks/s";
+    }
+
+    return 0;
+}
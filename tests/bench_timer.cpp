@@ -0,0 +1,80 @@
+#include "source/headers.hpp"
+
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static double nsPerOp(std::chrono::steady_clock::time_point start, size_t ops) {
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    uint64_t maxMs = argc > 2 ? strtoull(argv[2], nullptr, 10) : 3000;
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+
+    Server::TimerManager timers;
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> delays(n);
+    for (auto& d : delays) {
+        d = 1 + rng() % maxMs;
+    }
+
+    // add n timers due within maxMs
+    std::atomic<size_t> fired{ 0 };
+    std::vector<Server::Timer::ptr> handles(n);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        handles[i] = timers.addTimer(delays[i], [&fired]() { ++fired; });
+    }
+    double addNs = nsPerOp(start, n);
+
+    // next deadline with n timers pending
+    start = std::chrono::steady_clock::now();
+    uint64_t next = 0;
+    for (int i = 0; i < 1000; ++i) {
+        next += timers.getNextTimer();
+    }
+    double nextNs = nsPerOp(start, 1000);
+
+    // cancel every other timer
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i += 2) {
+        handles[i]->cancel();
+    }
+    double cancelNs = nsPerOp(start, (n + 1) / 2);
+    handles.clear();
+
+    // wait for the rest the way IOManager does, time spent expiring per timer
+    std::vector<Server::Callable> cbs;
+    std::chrono::duration<double, std::nano> expireTime{ 0 };
+    size_t expired = 0;
+    size_t polls = 0;
+    while (timers.hasTimer()) {
+        uint64_t wait = timers.getNextTimer();
+        if (wait) {
+            usleep(wait * 1000);
+        }
+        auto t = std::chrono::steady_clock::now();
+        timers.listExpiredCb(cbs);
+        expireTime += std::chrono::steady_clock::now() - t;
+        expired += cbs.size();
+        ++polls;
+        for (auto& cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+
+    SERVER_LOG_INFO(g_logger) << "timers: " << n
+                              << " add: " << addNs << " ns"
+                              << " getNextTimer: " << nextNs << " ns"
+                              << " cancel: " << cancelNs << " ns"
+                              << " expire: " << expireTime.count() / std::max<size_t>(expired, 1) << " ns"
+                              << " fired: " << fired << " in " << polls << " polls";
+    SERVER_ASSERT(fired == n / 2);
+    return 0;
+}
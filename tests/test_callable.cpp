@@ -0,0 +1,130 @@
+#include "source/headers.hpp"
+#include "source/callable.hpp"
+
+#include <atomic>
+#include <stdlib.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// count heap allocations made by the process, the replacement
+// operators are backed by malloc/free
+static std::atomic<uint64_t> s_allocs{ 0 };
+
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static int s_called = 0;
+
+void func() {
+    ++s_called;
+}
+
+void test_inline() {
+    uint64_t a = 1, b = 2, c = 3, d = 4, e = 5;
+    uint64_t before = s_allocs;
+    {
+        // 40 bytes of captures are stored in place
+        Server::Callable cb([a, b, c, d, e]() { s_called += a + b + c + d + e; });
+        Server::Callable moved(std::move(cb));
+        SERVER_ASSERT(!cb);
+        moved();
+    }
+    uint64_t allocs = s_allocs - before;
+    SERVER_LOG_INFO(g_logger) << "inline lambda allocations: " << allocs;
+    SERVER_ASSERT(allocs == 0);
+    SERVER_ASSERT(s_called == 15);
+}
+
+void test_heap() {
+    char big[128] = { 0 };
+    big[0] = 1;
+    uint64_t before = s_allocs;
+    {
+        // captures larger than the inline storage go to heap once
+        Server::Callable cb([big]() { s_called += big[0]; });
+        Server::Callable moved;
+        moved = std::move(cb);
+        moved();
+    }
+    uint64_t allocs = s_allocs - before;
+    SERVER_LOG_INFO(g_logger) << "heap lambda allocations: " << allocs;
+    SERVER_ASSERT(allocs == 1);
+    SERVER_ASSERT(s_called == 16);
+}
+
+void test_empty() {
+    void (*fp)() = nullptr;
+    Server::Callable cb(fp);
+    SERVER_ASSERT(!cb);
+
+    std::function<void()> empty;
+    Server::Callable cb2(empty);
+    SERVER_ASSERT(!cb2);
+
+    Server::Callable cb3(&func);
+    SERVER_ASSERT(cb3);
+    cb3();
+    cb3 = nullptr;
+    SERVER_ASSERT(!cb3);
+    SERVER_ASSERT(s_called == 17);
+}
+
+static std::atomic<uint64_t> s_sum{ 0 };
+
+// a worker scheduling a lambda with 40 bytes of captures in steady state
+// takes the queue node from its cache and keeps the captures inline
+void test_schedule() {
+    Server::Scheduler sc(1, false, "callable");
+    sc.start();
+
+    static const int TASKS = 256;
+    uint64_t a = 1, b = 2, c = 3, d = 4;
+    // the first round fills the node cache, the deque and the fiber cache
+    for (int round = 0; round < 3; ++round) {
+        Server::WaitGroup wg(TASKS);
+        std::atomic<uint64_t> allocs{ 0 };
+        sc.schedule([&]() {
+            uint64_t before = s_allocs;
+            for (int i = 0; i < TASKS; ++i) {
+                sc.schedule([a, b, c, d, &wg]() {
+                    s_sum += a + b + c + d;
+                    wg.done();
+                });
+            }
+            allocs = s_allocs - before;
+        });
+        wg.wait();
+
+        SERVER_LOG_INFO(g_logger) << "round " << round << " schedule allocations: " << allocs;
+        if (round > 0) {
+            SERVER_ASSERT(allocs == 0);
+        }
+    }
+    sc.stop();
+    SERVER_ASSERT(s_sum == 3 * TASKS * 10);
+}
+
+int main() {
+    test_inline();
+    test_heap();
+    test_empty();
+    test_schedule();
+    SERVER_LOG_INFO(g_logger) << "sizeof(Callable) = " << sizeof(Server::Callable);
+    return 0;
+}
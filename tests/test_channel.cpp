@@ -0,0 +1,149 @@
+#include "source/headers.hpp"
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int PRODUCERS = 4;
+static const int CONSUMERS = 4;
+static const int MESSAGES = 10000;
+
+// producers and consumers on two schedulers share a small buffered channel
+void test_mpmc(Server::Scheduler& a, Server::Scheduler& b) {
+    Server::Channel<int> ch(16);
+    Server::WaitGroup producers(PRODUCERS);
+    Server::WaitGroup consumers(CONSUMERS);
+    std::atomic<int64_t> sum{ 0 };
+    std::atomic<int> received{ 0 };
+
+    for (int i = 0; i < PRODUCERS; ++i) {
+        a.schedule([&]() {
+            for (int j = 1; j <= MESSAGES; ++j) {
+                SERVER_ASSERT(ch.send(j));
+            }
+            producers.done();
+        });
+    }
+
+    for (int i = 0; i < CONSUMERS; ++i) {
+        b.schedule([&]() {
+            int v = 0;
+            while (ch.recv(v)) {
+                sum += v;
+                ++received;
+            }
+            consumers.done();
+        });
+    }
+
+    producers.wait();
+    ch.close();
+    consumers.wait();
+
+    SERVER_LOG_INFO(g_logger) << "mpmc received: " << received << " sum: " << sum;
+    SERVER_ASSERT(received == PRODUCERS * MESSAGES);
+    SERVER_ASSERT(sum == int64_t(PRODUCERS) * MESSAGES * (MESSAGES + 1) / 2);
+    SERVER_ASSERT(!ch.send(1));
+}
+
+// unbuffered channel hands every value from sender to receiver directly
+void test_rendezvous(Server::Scheduler& sc) {
+    Server::Channel<std::string> ch;
+    Server::WaitGroup wg(1);
+    sc.schedule([&]() {
+        for (int i = 0; i < 100; ++i) {
+            SERVER_ASSERT(ch.send(std::to_string(i)));
+        }
+        ch.close();
+        wg.done();
+    });
+
+    std::string v;
+    int count = 0;
+    while (ch.recv(v)) {
+        SERVER_ASSERT(v == std::to_string(count));
+        ++count;
+    }
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "rendezvous received: " << count;
+    SERVER_ASSERT(count == 100);
+}
+
+void test_try() {
+    Server::Channel<int> ch(2);
+    int v = 0;
+    SERVER_ASSERT(!ch.tryRecv(v));
+    SERVER_ASSERT(ch.trySend(1));
+    SERVER_ASSERT(ch.trySend(2));
+    SERVER_ASSERT(!ch.trySend(3));
+    SERVER_ASSERT(ch.size() == 2);
+
+    // buffered values can still be drained after close
+    ch.close();
+    SERVER_ASSERT(ch.tryRecv(v) && v == 1);
+    SERVER_ASSERT(ch.recv(v) && v == 2);
+    SERVER_ASSERT(!ch.recv(v));
+}
+
+// a coroutine selects over two channels fed from another scheduler
+void test_select(Server::Scheduler& a, Server::Scheduler& b) {
+    Server::Channel<int> numbers;
+    Server::Channel<std::string> words;
+    Server::Channel<int> quit;
+    Server::WaitGroup wg(2);
+    int gotNumbers = 0;
+    int gotWords = 0;
+
+    a.schedule([&]() {
+        int n = 0;
+        std::string w;
+        int q = 0;
+        while (true) {
+            Server::SelectResult r = Server::select(numbers.recvCase(n),
+                                                    words.recvCase(w),
+                                                    quit.recvCase(q));
+            if (r.index == 0) {
+                ++gotNumbers;
+            } else if (r.index == 1) {
+                ++gotWords;
+            } else {
+                break;
+            }
+        }
+        wg.done();
+    });
+
+    b.schedule([&]() {
+        for (int i = 0; i < 100; ++i) {
+            numbers.send(i);
+            words.send("w");
+        }
+        quit.send(1);
+        wg.done();
+    });
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "select numbers: " << gotNumbers << " words: " << gotWords;
+    SERVER_ASSERT(gotNumbers == 100 && gotWords == 100);
+
+    int n = 0;
+    SERVER_ASSERT(Server::trySelect(numbers.recvCase(n)).index == -1);
+    numbers.close();
+    Server::SelectResult r = Server::trySelect(numbers.recvCase(n));
+    SERVER_ASSERT(r.index == 0 && !r.ok);
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    Server::Scheduler a(2, false, "chan_a");
+    Server::Scheduler b(2, false, "chan_b");
+    a.start();
+    b.start();
+
+    test_mpmc(a, b);
+    test_rendezvous(a);
+    test_try();
+    test_select(a, b);
+
+    a.stop();
+    b.stop();
+    return 0;
+}
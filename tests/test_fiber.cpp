@@ -25,8 +25,201 @@ void test_fiber() {
     SERVER_LOG_INFO(g_logger) << "main after end 2";
 }
 
+void test_fiber_cache() {
+    Server::Fiber::getThis();
+    Server::Fiber* raw = nullptr;
+    {
+        Server::Fiber::ptr fiber = Server::Fiber::create(run_in_fiber);
+        raw = fiber.get();
+        fiber->swapIn();
+        fiber->swapIn();
+        fiber->swapIn();
+    }
+
+    // terminated coroutine is handed back to the thread cache and reused
+    Server::Fiber::ptr fiber = Server::Fiber::create(run_in_fiber);
+    SERVER_LOG_INFO(g_logger) << "fiber reused: " << (raw == fiber.get());
+    SERVER_ASSERT(raw == fiber.get());
+    fiber->swapIn();
+    fiber->swapIn();
+    fiber->swapIn();
+}
+
+// touch about 8KB of coroutine stack
+void deep_in_fiber() {
+    volatile char buf[8192];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        buf[i] = 0;
+    }
+}
+
+void test_stack_watermark() {
+    Server::Fiber::getThis();
+    auto watermark = Server::ConfigMgr::lookUp<bool>("fiber.stack_watermark");
+    watermark->setValue(true);
+    {
+        Server::Fiber::ptr fiber = std::make_shared<Server::Fiber>(deep_in_fiber);
+        fiber->swapIn();
+    }
+    watermark->setValue(false);
+
+    Server::Log2Histogram& usage = Server::Fiber::getStackUsage();
+    SERVER_LOG_INFO(g_logger) << "stack usage: " << usage.toString();
+    SERVER_ASSERT(usage.count() == 1);
+    SERVER_ASSERT(usage.max() >= 8192);
+}
+
+// counts live values to check locals are freed with their coroutine
+struct LocalValue {
+    static int s_live;
+    int value = 0;
+    LocalValue() { ++s_live; }
+    ~LocalValue() { --s_live; }
+};
+
+int LocalValue::s_live = 0;
+
+static Server::FiberLocal<LocalValue> s_local;
+
+void local_in_fiber(int value) {
+    SERVER_ASSERT(!s_local.has());
+    s_local->value = value;
+    Server::Fiber::yieldToHold();
+    SERVER_ASSERT(s_local->value == value);
+}
+
+void test_fiber_local() {
+    Server::Fiber::getThis();
+    s_local->value = -1;
+    {
+        Server::Fiber::ptr a = Server::Fiber::create(std::bind(&local_in_fiber, 1));
+        Server::Fiber::ptr b = Server::Fiber::create(std::bind(&local_in_fiber, 2));
+        a->swapIn();
+        b->swapIn();
+        SERVER_ASSERT(LocalValue::s_live == 3);
+        a->swapIn();
+        b->swapIn();
+    }
+
+    // values of terminated coroutines are freed, main coroutine keeps its own
+    SERVER_LOG_INFO(g_logger) << "live fiber locals: " << LocalValue::s_live;
+    SERVER_ASSERT(LocalValue::s_live == 1);
+    SERVER_ASSERT(s_local->value == -1);
+    s_local.reset();
+    SERVER_ASSERT(LocalValue::s_live == 0);
+}
+
+// fill locals at every depth, yield at the bottom and on the way back, and
+// check them after each resume. returns the number of checks passed
+static int nested_in_fiber(int id, int depth) {
+    int locals[64];
+    for (int i = 0; i < 64; ++i) {
+        locals[i] = id * 100000 + depth * 100 + i;
+    }
+
+    int checks = 0;
+    if (depth > 0) {
+        checks += nested_in_fiber(id, depth - 1);
+    }
+    Server::Fiber::yieldToHold();
+
+    for (int i = 0; i < 64; ++i) {
+        SERVER_ASSERT_INFO(locals[i] == id * 100000 + depth * 100 + i,
+                        "stack local lost across a switch");
+    }
+    return checks + 1;
+}
+
+// shared-stack coroutines interleaved with private ones on one thread keep
+// their frames across every save and restore
+void test_shared_stack() {
+    Server::Fiber::getThis();
+    // one stack for the thread, so every shared coroutine evicts another
+    auto stackCount = Server::ConfigMgr::lookUp<uint32_t>("fiber.shared_stack_count");
+    uint32_t stacks = stackCount->getValue();
+    stackCount->setValue(1);
+
+    static const int FIBERS = 6;
+    static const int DEPTH = 8;
+    int checks[FIBERS] = {};
+    std::vector<Server::Fiber::ptr> fibers;
+    for (int i = 0; i < FIBERS; ++i) {
+        // every third coroutine keeps a private stack
+        auto mode = i % 3 == 2 ? Server::Fiber::StackMode::PRIVATE
+                               : Server::Fiber::StackMode::SHARED;
+        fibers.push_back(std::make_shared<Server::Fiber>([&checks, i]() {
+            SERVER_ASSERT(Server::Fiber::onSharedStack() == (i % 3 != 2));
+            checks[i] = nested_in_fiber(i + 1, DEPTH + i);
+        }, 0, false, mode));
+    }
+
+    // round robin until all finish, each switch lands on another frame set
+    bool running = true;
+    while (running) {
+        running = false;
+        for (auto& fiber : fibers) {
+            if (fiber->getState() != Server::Fiber::State::TERM) {
+                fiber->swapIn();
+                running = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < FIBERS; ++i) {
+        SERVER_ASSERT(checks[i] == DEPTH + i + 1);
+    }
+    SERVER_ASSERT(fibers[0]->getBoundThread() == Server::getThreadId());
+    SERVER_ASSERT(fibers[2]->getBoundThread() == -1);
+    SERVER_ASSERT(Server::Fiber::boundFibers() == 0);
+    stackCount->setValue(stacks);
+    SERVER_LOG_INFO(g_logger) << "shared stack fibers passed";
+}
+
+// a shared-stack coroutine scheduled without a thread is routed back to the
+// worker it is bound to
+void test_shared_bound() {
+    Server::Scheduler sc(3, false, "bound");
+    sc.start();
+
+    static const int ROUNDS = 200;
+    std::atomic<int> runs{ 0 };
+    std::atomic<int> moved{ 0 };
+    Server::Fiber::ptr fiber = std::make_shared<Server::Fiber>([&]() {
+        int bound = Server::getThreadId();
+        for (int i = 0; i < ROUNDS; ++i) {
+            if (Server::getThreadId() != bound) {
+                ++moved;
+            }
+            ++runs;
+            Server::Fiber::yieldToHold();
+        }
+    }, 0, false, Server::Fiber::StackMode::SHARED);
+
+    sc.schedule(fiber);
+    for (int i = 1; i <= ROUNDS; ++i) {
+        while (runs < i || fiber->getState() != Server::Fiber::State::HOLD) {
+            usleep(100);
+        }
+        SERVER_ASSERT(fiber->getBoundThread() != -1);
+        sc.schedule(fiber);
+    }
+
+    while (fiber->getState() != Server::Fiber::State::TERM) {
+        usleep(100);
+    }
+    sc.stop();
+    SERVER_LOG_INFO(g_logger) << "bound fiber ran " << runs << " times, moved " << moved;
+    SERVER_ASSERT(runs == ROUNDS && moved == 0);
+}
+
 int main() {
     Server::Thread::setName("main");
+    test_fiber_cache();
+    test_stack_watermark();
+    test_fiber_local();
+    test_shared_stack();
+    test_shared_bound();
+
     std::vector<Server::Thread::ptr> threads;
 
     for (int i = 0; i < 3; ++i) {
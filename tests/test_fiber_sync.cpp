@@ -0,0 +1,146 @@
+#include "source/headers.hpp"
+
+#include <deque>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int FIBERS = 8;
+static const int ROUNDS = 1000;
+
+// fibers increment a counter under the mutex and yield while holding it,
+// so the others have to park on the lock
+void test_mutex(Server::Scheduler& sc) {
+    Server::FiberMutex mutex;
+    Server::WaitGroup wg(FIBERS);
+    int64_t counter = 0;
+
+    for (int i = 0; i < FIBERS; ++i) {
+        sc.schedule([&]() {
+            for (int j = 0; j < ROUNDS; ++j) {
+                Server::FiberMutex::Lock lock(mutex);
+                int64_t v = counter;
+                if (j % 100 == 0) {
+                    Server::Fiber::yieldToReady();
+                }
+                counter = v + 1;
+            }
+            wg.done();
+        });
+    }
+
+    // main thread is not a coroutine, it blocks on the wait group
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "mutex counter: " << counter;
+    SERVER_ASSERT(counter == FIBERS * ROUNDS);
+}
+
+// one producer and several consumers on a queue guarded by mutex and condvar
+void test_condvar(Server::Scheduler& sc) {
+    Server::FiberMutex mutex;
+    Server::FiberCondVar cond;
+    Server::WaitGroup wg(FIBERS + 1);
+    std::deque<int> queue;
+    int64_t sum = 0;
+    bool finished = false;
+
+    for (int i = 0; i < FIBERS; ++i) {
+        sc.schedule([&]() {
+            while (true) {
+                Server::FiberMutex::Lock lock(mutex);
+                cond.wait(lock, [&]() { return !queue.empty() || finished; });
+                if (queue.empty()) {
+                    break;
+                }
+                sum += queue.front();
+                queue.pop_front();
+            }
+            wg.done();
+        });
+    }
+
+    sc.schedule([&]() {
+        for (int i = 1; i <= ROUNDS; ++i) {
+            Server::FiberMutex::Lock lock(mutex);
+            queue.push_back(i);
+            cond.notifyOne();
+        }
+        {
+            Server::FiberMutex::Lock lock(mutex);
+            finished = true;
+        }
+        cond.notifyAll();
+        wg.done();
+    });
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "condvar sum: " << sum;
+    SERVER_ASSERT(sum == ROUNDS * (ROUNDS + 1) / 2);
+}
+
+// semaphore limits how many fibers are inside the section at once
+void test_semaphore(Server::Scheduler& sc) {
+    Server::FiberSemaphore sem(2);
+    Server::WaitGroup wg;
+    std::atomic<int> inside{ 0 };
+    std::atomic<int> peak{ 0 };
+
+    for (int i = 0; i < FIBERS; ++i) {
+        wg.add();
+        sc.schedule([&]() {
+            for (int j = 0; j < 10; ++j) {
+                sem.wait();
+                int n = ++inside;
+                int p = peak;
+                while (n > p && !peak.compare_exchange_weak(p, n));
+                Server::Fiber::yieldToReady();
+                --inside;
+                sem.notify();
+            }
+            wg.done();
+        });
+    }
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "semaphore peak: " << peak << " permits left: " << sem.getCount();
+    SERVER_ASSERT(peak <= 2);
+    SERVER_ASSERT(sem.getCount() == 2);
+}
+
+// a group on the stack is gone as soon as wait() returns, the last done()
+// on another worker must be finished with it by then
+void test_waitgroup_lifetime(Server::Scheduler& sc) {
+    static const int LOOPS = 20000;
+    Server::WaitGroup all(2);
+    std::atomic<int> rounds{ 0 };
+
+    // from a coroutine, which parks, and from a thread, which blocks
+    auto loop = [&sc, &rounds]() {
+        for (int i = 0; i < LOOPS; ++i) {
+            Server::WaitGroup wg(1);
+            sc.schedule([&wg]() { wg.done(); });
+            wg.wait();
+            ++rounds;
+        }
+    };
+    sc.schedule([&]() { loop(); all.done(); });
+    loop();
+    all.done();
+    all.wait();
+
+    SERVER_LOG_INFO(g_logger) << "waitgroup rounds: " << rounds;
+    SERVER_ASSERT(rounds == 2 * LOOPS);
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    Server::Scheduler sc(4, false, "sync");
+    sc.start();
+
+    test_mutex(sc);
+    test_condvar(sc);
+    test_semaphore(sc);
+    test_waitgroup_lifetime(sc);
+
+    sc.stop();
+    return 0;
+}
@@ -6,7 +6,10 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <netinet/in.h>
+#include <thread>
 #include <iostream>
+#include <algorithm>
 
 Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
 
@@ -46,8 +49,198 @@ void test1() {
     ioMgr.schedule(&test_fiber);
 }
 
+static const int HOPS = 2000;
+
+// a task pinned to one worker thread hands the next hop to another
+static void hop(Server::IOManager* iom, std::vector<int>* threads, Server::WaitGroup* wg, int n) {
+    SERVER_ASSERT(Server::getThreadId() == (*threads)[n % threads->size()]);
+    if (n + 1 == HOPS) {
+        wg->done();
+        return;
+    }
+
+    iom->schedule([iom, threads, wg, n]() { hop(iom, threads, wg, n + 1); },
+                  (*threads)[(n + 1) % threads->size()]);
+}
+
+void test_pinned() {
+    Server::IOManager iom(4, false, "pinned");
+
+    // learn the worker threads, a sleeping task lets the others take the next ones
+    Server::Mutex mutex;
+    std::vector<int> threads;
+    Server::WaitGroup learned(16);
+    for (int i = 0; i < 16; ++i) {
+        iom.schedule([&]() {
+            usleep(2000);
+            Server::Mutex::Lock lock(mutex);
+            int id = Server::getThreadId();
+            if (std::find(threads.begin(), threads.end(), id) == threads.end()) {
+                threads.push_back(id);
+            }
+            learned.done();
+        });
+    }
+    learned.wait();
+
+    // pinned from outside the pool and from the workers themselves
+    Server::WaitGroup wg(threads.size());
+    for (size_t i = 0; i < threads.size(); ++i) {
+        iom.schedule([&iom, &threads, &wg, i]() { hop(&iom, &threads, &wg, i); }, threads[i]);
+    }
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "pinned hops done on " << threads.size() << " threads";
+}
+
+// tasks pinned to the worker while it sleeps in the poller share the one
+// pending wakeup instead of writing the eventfd once each
+void test_burst() {
+    static const int TASKS = 100000;
+    Server::IOManager iom(1, false, "burst");
+
+    std::atomic<int> worker{ -1 };
+    iom.schedule([&worker]() { worker = Server::getThreadId(); });
+    while (worker == -1) {
+        usleep(1000);
+    }
+
+    // out of tasks, it goes on to block in the poller
+    while (iom.getIdleThreadCount() == 0) {
+        usleep(1000);
+    }
+    usleep(50 * 1000);
+    Server::Scheduler::Stats before;
+    iom.getStats(before);
+
+    Server::WaitGroup wg(TASKS);
+    for (int i = 0; i < TASKS; ++i) {
+        iom.schedule([&wg]() { wg.done(); }, worker);
+    }
+    wg.wait();
+
+    Server::Scheduler::Stats stats;
+    iom.getStats(stats);
+    uint64_t wakeups = stats.wakeups - before.wakeups;
+    uint64_t notifies = stats.notifies - before.notifies;
+    SERVER_LOG_INFO(g_logger) << "burst of " << TASKS << " tasks, " << notifies
+                            << " notifies, " << wakeups << " wakeups";
+    SERVER_ASSERT(wakeups >= 1);
+    SERVER_ASSERT(wakeups < notifies / 10);
+}
+
+// recv parked before the data arrives, send, and accept of a connection
+// made from another thread, all without blocking the worker
+void test_io(const std::string& poller) {
+    Server::IOManager iom(2, false, "io");
+    // io_uring falls back to epoll where the kernel or seccomp refuses it
+    std::string name = iom.getPollerName();
+    SERVER_ASSERT(name == "epoll" || name == "io_uring");
+    if (name != poller) {
+        SERVER_LOG_INFO(g_logger) << poller << " unavailable, running on " << name;
+    }
+
+    int fds[2];
+    SERVER_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+
+    Server::WaitGroup wg(2);
+    iom.schedule([&]() {
+        char buf[16] = {};
+        ssize_t n = iom.recv(fds[0], buf, sizeof(buf));
+        SERVER_ASSERT(n == 5 && !memcmp(buf, "hello", 5));
+        wg.done();
+    });
+    iom.schedule([&]() {
+        usleep(10000);
+        SERVER_ASSERT(iom.send(fds[1], "hello", 5) == 5);
+        wg.done();
+    });
+    wg.wait();
+    close(fds[0]);
+    close(fds[1]);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    SERVER_ASSERT(!bind(listener, (sockaddr*)&addr, sizeof(addr)));
+    SERVER_ASSERT(!listen(listener, 16));
+    SERVER_ASSERT(!getsockname(listener, (sockaddr*)&addr, &len));
+
+    static const int CONNS = 8;
+    Server::WaitGroup accepted(1);
+    iom.schedule([&]() {
+        for (int i = 0; i < CONNS; ++i) {
+            int client = iom.accept(listener, nullptr, nullptr, SOCK_NONBLOCK);
+            SERVER_ASSERT(client >= 0);
+            char c = 0;
+            SERVER_ASSERT(iom.recv(client, &c, 1) == 1 && c == 'x');
+            close(client);
+        }
+        accepted.done();
+    });
+
+    std::thread connector([&]() {
+        usleep(10000);
+        for (int i = 0; i < CONNS; ++i) {
+            int c = socket(AF_INET, SOCK_STREAM, 0);
+            SERVER_ASSERT(!connect(c, (sockaddr*)&addr, sizeof(addr)));
+            SERVER_ASSERT(::send(c, "x", 1, 0) == 1);
+            close(c);
+        }
+    });
+    accepted.wait();
+    connector.join();
+    close(listener);
+    SERVER_LOG_INFO(g_logger) << "io on " << iom.getPollerName() << " done";
+}
+
+// parked calls end with ECANCELED when their fd is cancelled, from a
+// timer or by stopping the IOManager
+void test_cancel() {
+    int fds[2];
+    SERVER_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+    std::atomic<int> cancelled{ 0 };
+    {
+        Server::IOManager iom(1, false, "cancel");
+        Server::WaitGroup wg(1);
+        iom.schedule([&]() {
+            char c;
+            iom.addTimer(20, [&iom, &fds]() { iom.cancelEvent(fds[0], Server::IOManager::READ); });
+            ssize_t n = iom.recv(fds[0], &c, 1);
+            SERVER_ASSERT(n == -1 && errno == ECANCELED);
+            ++cancelled;
+            wg.done();
+        });
+        wg.wait();
+
+        // nothing ever arrives, stop() has to abort it
+        iom.schedule([&]() {
+            char c;
+            ssize_t n = iom.recv(fds[1], &c, 1);
+            SERVER_ASSERT(n == -1 && errno == ECANCELED);
+            ++cancelled;
+        });
+        usleep(10000);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    SERVER_LOG_INFO(g_logger) << "cancelled " << cancelled << " parked calls";
+    SERVER_ASSERT(cancelled == 2);
+}
+
 int main(int argc, char** argv) {
-    test1(); 
+    // the suite once per backend, io_uring falls back to epoll where it is missing
+    auto poller = Server::ConfigMgr::lookUp<std::string>("iomanager.poller");
+    for (const char* name : {"epoll", "io_uring"}) {
+        poller->setValue(name);
+        test1();
+        test_pinned();
+        test_burst();
+        test_io(name);
+        test_cancel();
+    }
    
     return 0;
 }
\ No newline at end of file
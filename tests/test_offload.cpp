@@ -0,0 +1,108 @@
+#include "source/headers.hpp"
+#include "source/iomanager.hpp"
+
+#include <stdexcept>
+#include <unistd.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// blocking calls of many coroutines overlap on the pool while the single
+// worker thread keeps running other coroutines
+void test_overlap(Server::IOManager& iom) {
+    Server::OffloadPool pool(8, 64, "test_offload");
+    Server::WaitGroup wg(8);
+    std::atomic<bool> sleeping{ true };
+    std::atomic<int> ticks{ 0 };
+
+    uint64_t start = Server::getCurrentMS();
+    for (int i = 0; i < 8; ++i) {
+        iom.schedule([&, i]() {
+            int r = pool.call([i]() {
+                usleep(100 * 1000);
+                return i * i;
+            });
+            // resumed on the scheduler that made the call
+            SERVER_ASSERT(Server::Scheduler::getThis() == &iom);
+            SERVER_ASSERT(r == i * i);
+            wg.done();
+        });
+    }
+
+    iom.schedule([&]() {
+        while (sleeping) {
+            ++ticks;
+            Server::Fiber::yieldToReady();
+        }
+    });
+
+    wg.wait();
+    sleeping = false;
+    uint64_t elapsed = Server::getCurrentMS() - start;
+    SERVER_LOG_INFO(g_logger) << "overlap elapsed: " << elapsed << "ms ticks: " << ticks;
+    SERVER_ASSERT(elapsed < 8 * 100);
+    SERVER_ASSERT(ticks > 0);
+}
+
+// callers park once queue_limit jobs wait for a thread
+void test_backpressure(Server::Scheduler& sc) {
+    Server::OffloadPool pool(1, 2, "test_offload");
+    Server::WaitGroup wg(20);
+    std::atomic<size_t> maxQueued{ 0 };
+    std::atomic<int> done{ 0 };
+
+    for (int i = 0; i < 20; ++i) {
+        sc.schedule([&]() {
+            pool.run([&]() {
+                size_t queued = pool.getQueued();
+                size_t prev = maxQueued;
+                while (queued > prev && !maxQueued.compare_exchange_weak(prev, queued)) {}
+                usleep(1000);
+                ++done;
+            });
+            wg.done();
+        });
+    }
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "backpressure max queued: " << maxQueued;
+    SERVER_ASSERT(done == 20);
+    SERVER_ASSERT(maxQueued <= 2);
+}
+
+void test_errors(Server::Scheduler& sc) {
+    Server::WaitGroup wg(1);
+    bool caught = false;
+    sc.schedule([&]() {
+        try {
+            Server::offload([]() { throw std::runtime_error("boom"); });
+        } catch (const std::runtime_error& e) {
+            caught = std::string(e.what()) == "boom";
+        }
+        wg.done();
+    });
+    wg.wait();
+    SERVER_ASSERT(caught);
+
+    // a plain thread blocks until the job is done
+    SERVER_ASSERT(Server::offload([]() { return std::string("plain"); }) == "plain");
+
+    // a stopped pool runs jobs in the caller
+    Server::OffloadPool pool(1, 1, "test_offload");
+    pool.stop();
+    SERVER_ASSERT(pool.call([]() { return 7; }) == 7);
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    Server::IOManager iom(1, false, "offload_iom");
+    Server::Scheduler sc(2, false, "offload_sc");
+    sc.start();
+
+    test_overlap(iom);
+    test_backpressure(sc);
+    test_errors(sc);
+
+    sc.stop();
+    iom.stop();
+    return 0;
+}
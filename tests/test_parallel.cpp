@@ -0,0 +1,124 @@
+#include "source/headers.hpp"
+
+#include <numeric>
+#include <stdexcept>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static const int N = 100000;
+
+// every index is visited exactly once, whatever the grain
+void test_for(Server::Scheduler& sc) {
+    for (size_t grain : { 0, 1, 7, 1000, 1000000 }) {
+        std::vector<std::atomic<int>> hits(N);
+        Server::parallelFor(&sc, 0, N, [&](int i) { ++hits[i]; }, grain);
+        for (int i = 0; i < N; ++i) {
+            SERVER_ASSERT(hits[i] == 1);
+        }
+    }
+
+    std::vector<int> v(N);
+    std::iota(v.begin(), v.end(), 0);
+    Server::parallelFor(&sc, v, [](int& x) { x *= 2; });
+    for (int i = 0; i < N; ++i) {
+        SERVER_ASSERT(v[i] == 2 * i);
+    }
+
+    // empty range returns at once
+    Server::parallelFor(&sc, 5, 5, [](int) { SERVER_ASSERT(false); });
+    SERVER_LOG_INFO(g_logger) << "parallelFor ok";
+}
+
+void test_reduce(Server::Scheduler& sc) {
+    int64_t sum = Server::parallelReduce(&sc, 0, N, int64_t(0),
+                                         [](int i) { return int64_t(i); },
+                                         [](int64_t a, int64_t b) { return a + b; });
+    SERVER_ASSERT(sum == int64_t(N) * (N - 1) / 2);
+
+    // chunks are folded in order, a non commutative reduce still works
+    std::string s = Server::parallelReduce(&sc, 0, 1000, std::string(),
+                                           [](int i) { return std::string(1, 'a' + i % 26); },
+                                           [](std::string a, const std::string& b) { return a + b; },
+                                           3);
+    for (int i = 0; i < 1000; ++i) {
+        SERVER_ASSERT(s[i] == 'a' + i % 26);
+    }
+    SERVER_LOG_INFO(g_logger) << "parallelReduce sum: " << sum;
+}
+
+// a coroutine of the pool runs nested loops and joins without blocking its thread
+void test_nested(Server::Scheduler& sc) {
+    Server::WaitGroup wg(4);
+    std::atomic<int64_t> total{ 0 };
+    for (int t = 0; t < 4; ++t) {
+        sc.schedule([&]() {
+            Server::parallelFor(&sc, 0, 100, [&](int) {
+                total += Server::parallelReduce(&sc, 0, 1000, int64_t(0),
+                                                [](int i) { return int64_t(i); },
+                                                [](int64_t a, int64_t b) { return a + b; });
+            });
+            wg.done();
+        });
+    }
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "nested total: " << total;
+    SERVER_ASSERT(total == 4 * 100 * int64_t(999 * 1000 / 2));
+}
+
+// the join state lives on the caller's stack, a call returning right after
+// its last chunk finished on another worker must not leave it in use
+void test_short_calls(Server::Scheduler& sc) {
+    static const int CALLS = 20000;
+    Server::WaitGroup wg(1);
+    std::atomic<int64_t> total{ 0 };
+    sc.schedule([&]() {
+        for (int c = 0; c < CALLS; ++c) {
+            int hits[2] = { 0, 0 };
+            Server::parallelFor(&sc, 0, 2, [&hits](int i) { ++hits[i]; }, 1);
+            total += hits[0] + hits[1];
+        }
+        wg.done();
+    });
+    for (int c = 0; c < CALLS; ++c) {
+        total += Server::parallelReduce(&sc, 0, 2, 0, [](int) { return 1; },
+                                        [](int a, int b) { return a + b; }, 1);
+    }
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "short calls total: " << total;
+    SERVER_ASSERT(total == 4 * CALLS);
+}
+
+// the first exception reaches the caller once every task has finished
+void test_exception(Server::Scheduler& sc) {
+    bool caught = false;
+    try {
+        Server::parallelFor(&sc, 0, N, [](int i) {
+            if (i == N / 2) {
+                throw std::runtime_error("boom");
+            }
+        }, 100);
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "boom";
+    }
+    SERVER_ASSERT(caught);
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    Server::Scheduler one(1, false, "parallel_1");
+    Server::Scheduler sc(4, false, "parallel");
+    one.start();
+    sc.start();
+
+    for (Server::Scheduler* s : { &one, &sc }) {
+        test_for(*s);
+        test_reduce(*s);
+        test_nested(*s);
+        test_short_calls(*s);
+        test_exception(*s);
+    }
+
+    one.stop();
+    sc.stop();
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include "source/headers.hpp"
 
+#include <span>
+#include <sys/resource.h>
+
 Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
 
 void test_fiber() {
@@ -12,7 +15,392 @@ void test_fiber() {
     }
 }
 
+// batches from outside the pool and from a worker, every element runs once
+void test_bulk() {
+    Server::Scheduler sc(2, false, "bulk");
+    sc.start();
+
+    static const int TASKS = 100;
+    std::atomic<int> ran[TASKS] = {};
+    Server::WaitGroup wg(3 * TASKS);
+
+    std::vector<std::function<void()>> tasks;
+    for (int i = 0; i < TASKS; ++i) {
+        tasks.push_back([&ran, &wg, i]() { ++ran[i]; wg.done(); });
+    }
+
+    // iterator pair, copied through const iterators
+    sc.schedule(tasks.cbegin(), tasks.cend());
+
+    // span of lambdas taken by value
+    auto lambdas = std::vector<std::function<void()>>(tasks);
+    sc.schedule(std::span<std::function<void()>>(lambdas));
+
+    // fan-out from inside a task
+    sc.schedule([&]() { sc.schedule(tasks); });
+
+    wg.wait();
+    for (int i = 0; i < TASKS; ++i) {
+        SERVER_ASSERT(ran[i] == 3);
+    }
+    SERVER_LOG_INFO(g_logger) << "bulk scheduled " << 3 * TASKS << " tasks";
+    sc.stop();
+}
+
+// workers of a scheduler named in scheduler.affinity run on its cpus
+void test_affinity() {
+    YAML::Node root = YAML::Load("scheduler:\n"
+                                 "  affinity:\n"
+                                 "    pinned: { cpus: [0] }\n");
+    Server::ConfigMgr::loadFromYaml(root);
+
+    Server::Scheduler sc(2, false, "pinned");
+    sc.start();
+
+    Server::WaitGroup wg(2);
+    std::atomic<int> pinned{ 0 };
+    for (int i = 0; i < 2; ++i) {
+        sc.schedule([&]() {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+            if (CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set)) {
+                ++pinned;
+            }
+            wg.done();
+        });
+    }
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "tasks on cpu 0: " << pinned;
+    SERVER_ASSERT(pinned == 2);
+    sc.stop();
+}
+
+// idle workers park instead of spinning, and wake for new work
+void test_idle() {
+    Server::Scheduler sc(4, false, "idle");
+    sc.start();
+
+    rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    usleep(200 * 1000);
+    rusage after;
+    getrusage(RUSAGE_SELF, &after);
+
+    auto cpuUs = [](const rusage& r) {
+        return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000L
+            + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+    };
+    long used = cpuUs(after) - cpuUs(before);
+    SERVER_LOG_INFO(g_logger) << "cpu used by 4 idle workers in 200ms: " << used << "us";
+    SERVER_ASSERT(used < 50 * 1000);
+
+    Server::WaitGroup wg(1);
+    sc.schedule([&wg]() { wg.done(); });
+    wg.wait();
+    sc.stop();
+}
+
+// blocked workers are replaced up to the maximum, idle threads retire again
+void test_elastic() {
+    Server::ConfigMgr::lookUp<uint32_t>("scheduler.elastic.idle_timeout_ms")->setValue(100);
+
+    Server::Scheduler sc(1, false, "elastic");
+    sc.setElastic(1, 4);
+    sc.start();
+    SERVER_ASSERT(sc.getThreadCount() == 1);
+
+    // tasks sleeping in a blocking call hold their thread
+    static const int TASKS = 8;
+    Server::WaitGroup wg(TASKS);
+    for (int i = 0; i < TASKS; ++i) {
+        sc.schedule([&wg]() {
+            usleep(100 * 1000);
+            wg.done();
+        });
+    }
+
+    size_t peak = 0;
+    while (wg.getCount() > 0) {
+        peak = std::max(peak, sc.getThreadCount());
+        usleep(10 * 1000);
+    }
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "elastic peak threads: " << peak;
+    SERVER_ASSERT(peak > 1 && peak <= 4);
+
+    for (int i = 0; i < 100 && sc.getThreadCount() > 1; ++i) {
+        usleep(10 * 1000);
+    }
+    SERVER_LOG_INFO(g_logger) << "elastic threads after idle: " << sc.getThreadCount();
+    SERVER_ASSERT(sc.getThreadCount() == 1);
+
+    // the pool grows again from its minimum
+    Server::WaitGroup again(1);
+    sc.schedule([&again]() { again.done(); });
+    again.wait();
+    sc.stop();
+}
+
+// keep the cpu busy for us microseconds
+static void spin(uint64_t us) {
+    uint64_t end = Server::getCurrentUS() + us;
+    while (Server::getCurrentUS() < end);
+}
+
+// a long task fans work out to its own deque one by one, the other worker
+// steals each while the owner stays busy, however close to parking it is
+void test_fanout() {
+    // straight from the peer scan to parking, where a push could slip by
+    auto spinCount = Server::ConfigMgr::lookUp<uint32_t>("scheduler.spin_count");
+    uint32_t rounds = spinCount->getValue();
+    spinCount->setValue(0);
+
+    Server::Scheduler sc(2, false, "fanout");
+    sc.start();
+
+    static const int CHILDREN = 5000;
+    std::atomic<int> stolen{ 0 };
+    Server::WaitGroup wg(1);
+    sc.schedule([&]() {
+        pid_t owner = Server::getThreadId();
+        for (int i = 0; i < CHILDREN; ++i) {
+            std::atomic<bool> ran{ false };
+            sc.schedule([&]() {
+                if (Server::getThreadId() != owner) {
+                    ++stolen;
+                }
+                ran = true;
+            });
+
+            // never yields, a lost wakeup leaves the child queued until timeout
+            uint64_t deadline = Server::getCurrentUS() + 1000 * 1000;
+            while (!ran && Server::getCurrentUS() < deadline);
+            SERVER_ASSERT_INFO(ran, "child not stolen while its owner is busy");
+
+            // the thief goes back to idle for a varying while each round
+            for (volatile int k = 0; k < i % 1000; k = k + 1);
+        }
+        wg.done();
+    });
+
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "fanout stolen: " << stolen << "/" << CHILDREN;
+    SERVER_ASSERT(stolen == CHILDREN);
+    sc.stop();
+    spinCount->setValue(rounds);
+}
+
+// batch groups share the worker by weight, an interactive one jumps the queue
+void test_groups() {
+    Server::Scheduler sc(1, false, "groups");
+    Server::TaskGroup::ptr heavy = sc.addGroup("heavy", 3);
+    Server::TaskGroup::ptr light = sc.addGroup("light", 1);
+    Server::TaskGroup::ptr urgent = sc.addGroup("urgent", 1, Server::TaskPriority::INTERACTIVE);
+    SERVER_ASSERT(sc.addGroup("heavy") == heavy && sc.getGroup("light") == light);
+
+    static const int TASKS = 400;
+    std::atomic<int> heavyDone{ 0 };
+    std::atomic<int> lightDone{ 0 };
+    Server::WaitGroup wg(2 * TASKS);
+    for (int i = 0; i < TASKS; ++i) {
+        sc.schedule([&]() { spin(100); ++heavyDone; wg.done(); }, heavy);
+        sc.schedule([&]() { spin(100); ++lightDone; wg.done(); }, light);
+    }
+    SERVER_ASSERT(heavy->getQueueDepth() == TASKS && light->getQueueDepth() == TASKS);
+    Server::Scheduler::Stats queued;
+    sc.getStats(queued);
+    SERVER_ASSERT(queued.queued == 2 * TASKS);
+
+    sc.start();
+    while (heavyDone + lightDone < TASKS / 2) {
+        usleep(1000);
+    }
+
+    // queued behind hundreds of batch tasks, it still runs next
+    Server::WaitGroup urgentDone(1);
+    sc.schedule([&]() { urgentDone.done(); }, urgent);
+    urgentDone.wait();
+    int heavyAt = heavyDone;
+    int lightAt = lightDone;
+
+    wg.wait();
+    sc.stop();
+
+    Server::TaskGroup::Stats stats = urgent->getStats();
+    SERVER_LOG_INFO(g_logger) << "groups heavy: " << heavyAt << " light: " << lightAt
+                            << " urgent wait: " << stats.maxWaitUs << "us"
+                            << " light avg wait: " << light->getStats().avgWaitUs() << "us";
+    SERVER_ASSERT(heavyAt > 2 * lightAt && heavyAt < 4 * lightAt);
+    SERVER_ASSERT(stats.dispatched == 1 && heavy->getStats().dispatched == TASKS);
+    SERVER_ASSERT(heavy->getQueueDepth() == 0);
+}
+
+// a grouped coroutine woken after parking is charged to its group again
+void test_group_park() {
+    Server::Scheduler sc(1, false, "group_park");
+    Server::TaskGroup::ptr tenant = sc.addGroup("tenant", 1, Server::TaskPriority::BATCH);
+    sc.start();
+
+    Server::FiberSemaphore sem(0);
+    Server::WaitGroup wg(1);
+    std::atomic<Server::Fiber*> parked{ nullptr };
+    sc.schedule([&]() {
+        parked = Server::Fiber::getThis().get();
+        sem.wait();
+        wg.done();
+    }, tenant);
+    while (!parked || parked.load()->getState() != Server::Fiber::State::HOLD) {
+        usleep(1000);
+    }
+    sem.notify();
+    wg.wait();
+    sc.stop();
+
+    SERVER_LOG_INFO(g_logger) << "group park dispatched: " << tenant->getStats().dispatched;
+    SERVER_ASSERT(tenant->getStats().dispatched == 2);
+}
+
+static std::atomic<int> s_urgSignals{ 0 };
+
+static void onUrg(int) {
+    ++s_urgSignals;
+}
+
+// a coroutine over its budget is reported, one calling maybeYield lets
+// the tasks queued behind it run. SIGURG of the application still arrives
+void test_watchdog() {
+    auto budget = Server::ConfigMgr::lookUp<uint32_t>("scheduler.watchdog.budget_ms");
+    budget->setValue(20);
+    signal(SIGURG, &onUrg);
+
+    Server::Scheduler sc(1, false, "watchdog");
+    sc.start();
+
+    // never yields, only gets logged
+    Server::WaitGroup hog(1);
+    sc.schedule([&hog]() {
+        spin(100 * 1000);
+        hog.done();
+    });
+    hog.wait();
+
+    std::atomic<bool> quickDone{ false };
+    std::atomic<bool> quickFirst{ false };
+    Server::WaitGroup wg(2);
+    sc.schedule([&]() {
+        uint64_t end = Server::getCurrentUS() + 300 * 1000;
+        int yields = 0;
+        while (Server::getCurrentUS() < end) {
+            uint64_t before = Server::getCurrentUS();
+            Server::Fiber::maybeYield();
+            if (Server::getCurrentUS() - before > 100) {
+                ++yields;
+            }
+        }
+        quickFirst = quickDone.load();
+        SERVER_LOG_INFO(g_logger) << "watchdog preempted the loop " << yields << " times";
+        wg.done();
+    });
+    sc.schedule([&]() {
+        quickDone = true;
+        wg.done();
+    });
+    wg.wait();
+    SERVER_ASSERT(quickFirst);
+
+    int traced = s_urgSignals;
+    raise(SIGURG);
+    SERVER_LOG_INFO(g_logger) << "application SIGURG handler ran " << traced
+                            << " times for the watchdog, " << s_urgSignals - traced << " for raise";
+    SERVER_ASSERT(s_urgSignals > traced);
+
+    sc.stop();
+    budget->setValue(0);
+}
+
+// every task is timed, counters and histograms add up over the workers
+void test_stats() {
+    auto sample = Server::ConfigMgr::lookUp<uint32_t>("scheduler.stats_sample");
+    uint32_t oldSample = sample->getValue();
+    sample->setValue(1);
+
+    Server::Scheduler sc(2, false, "stats");
+    sc.start();
+
+    static const int TASKS = 1000;
+    Server::WaitGroup wg(TASKS);
+    for (int i = 0; i < TASKS; ++i) {
+        sc.schedule([&wg]() { wg.done(); });
+    }
+    wg.wait();
+    // the last slices are recorded after their tasks signal wg
+    sc.stop();
+
+    Server::Scheduler::Stats stats;
+    sc.getStats(stats);
+    SERVER_LOG_INFO(g_logger) << "scheduler stats: " << stats.toString();
+    SERVER_ASSERT(stats.tasks >= TASKS);
+    SERVER_ASSERT(stats.queueLatency.count() >= TASKS && stats.sliceTime.count() >= TASKS);
+    SERVER_ASSERT(stats.idles > 0 && stats.tasksPerSecond() > 0);
+    sample->setValue(oldSample);
+}
+
+// a coroutine hops to another scheduler and back with its locals intact
+void test_switch() {
+    Server::Scheduler io(2, false, "switch_io");
+    Server::Scheduler cpu(2, false, "switch_cpu");
+    io.start();
+    cpu.start();
+
+    // a thread of cpu to switch to
+    std::atomic<int> cpuThread{ 0 };
+    Server::WaitGroup found(1);
+    cpu.schedule([&]() {
+        cpuThread = Server::getThreadId();
+        found.done();
+    });
+    found.wait();
+
+    Server::WaitGroup wg(1);
+    io.schedule([&]() {
+        std::string local = "kept";
+        SERVER_ASSERT(Server::Scheduler::getThis() == &io);
+
+        Server::Scheduler::switchTo(&cpu, cpuThread);
+        SERVER_ASSERT(Server::Scheduler::getThis() == &cpu);
+        SERVER_ASSERT(Server::getThreadId() == cpuThread);
+
+        {
+            Server::SchedulerSwitcher sw(&io);
+            SERVER_ASSERT(Server::Scheduler::getThis() == &io);
+        }
+        SERVER_ASSERT(Server::Scheduler::getThis() == &cpu);
+
+        Server::Scheduler::switchTo(&io);
+        SERVER_ASSERT(Server::Scheduler::getThis() == &io && local == "kept");
+        wg.done();
+    });
+    wg.wait();
+    SERVER_LOG_INFO(g_logger) << "switched between schedulers";
+
+    io.stop();
+    cpu.stop();
+}
+
 int main() {
+    test_switch();
+    test_fanout();
+    test_stats();
+    test_watchdog();
+    test_groups();
+    test_group_park();
+    test_elastic();
+    test_idle();
+    test_bulk();
+    test_affinity();
+
     SERVER_LOG_INFO(g_logger) << "main";
     Server::Scheduler sc(3, true, "test");
     sc.start();
@@ -0,0 +1,106 @@
+#include "source/headers.hpp"
+#include "source/task.hpp"
+
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+static std::atomic<int> s_done{ 0 };
+
+Server::Task<int> square(int v) {
+    co_return v * v;
+}
+
+Server::Task<int> sum_of_squares(int n) {
+    int sum = 0;
+    for (int i = 1; i <= n; ++i) {
+        sum += co_await square(i);
+    }
+    co_return sum;
+}
+
+Server::Task<> compute() {
+    int sum = co_await sum_of_squares(10);
+    SERVER_LOG_INFO(g_logger) << "sum of squares: " << sum;
+    SERVER_ASSERT(sum == 385);
+    ++s_done;
+}
+
+Server::Task<> throwing() {
+    throw std::logic_error("task error");
+    co_return;
+}
+
+Server::Task<> catch_error() {
+    try {
+        co_await throwing();
+    } catch (std::logic_error& e) {
+        SERVER_LOG_INFO(g_logger) << "caught: " << e.what();
+        ++s_done;
+    }
+}
+
+// reader waits on the pipe until the writer task fills it
+Server::Task<> reader(int fd) {
+    bool ready = co_await Server::waitReadable(fd);
+    char buf[16] = { 0 };
+    int n = read(fd, buf, sizeof(buf) - 1);
+    SERVER_LOG_INFO(g_logger) << "readable=" << ready << " read: " << buf;
+    SERVER_ASSERT(ready && n == 5);
+    close(fd);
+    ++s_done;
+}
+
+Server::Task<> writer(int fd) {
+    co_await Server::waitWritable(fd);
+    SERVER_ASSERT(write(fd, "hello", 5) == 5);
+    close(fd);
+    ++s_done;
+}
+
+// hop from the IOManager onto another scheduler and back
+Server::Task<> hop(Server::Scheduler* other, Server::Scheduler* home) {
+    co_await Server::scheduleOn(other);
+    SERVER_ASSERT(Server::Scheduler::getThis() == other);
+    co_await Server::scheduleOn(home);
+    SERVER_ASSERT(Server::Scheduler::getThis() == home);
+    ++s_done;
+}
+
+Server::Task<> leaf(std::atomic<int>* count) {
+    ++*count;
+    co_return;
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    const int fanout = 100000;
+    std::atomic<int> leaves{ 0 };
+
+    Server::Scheduler other(1, false, "other");
+    other.start();
+    {
+        Server::IOManager iom(2, false, "task");
+        int fds[2];
+        SERVER_ASSERT(pipe(fds) == 0);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+        Server::spawn(compute(), &iom);
+        Server::spawn(catch_error(), &iom);
+        Server::spawn(reader(fds[0]), &iom);
+        Server::spawn(writer(fds[1]), &iom);
+        Server::spawn(hop(&other, &iom), &iom);
+        for (int i = 0; i < fanout; ++i) {
+            Server::spawn(leaf(&leaves), &iom);
+        }
+    }
+    other.stop();
+
+    SERVER_LOG_INFO(g_logger) << "tasks done: " << s_done << " leaves: " << leaves;
+    SERVER_ASSERT(s_done == 5);
+    SERVER_ASSERT(leaves == fanout);
+    return 0;
+}
@@ -45,7 +45,7 @@ int main() {
         threads.push_back(thread_2);
     }
 
-    for (int i = 0; i < threads.size(); ++i) {
+    for (size_t i = 0; i < threads.size(); ++i) {
         threads[i]->join();
     }
 
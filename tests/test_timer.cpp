@@ -0,0 +1,140 @@
+#include "source/headers.hpp"
+#include "source/iomanager.hpp"
+
+#include <random>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// wheel driven by a clock the test moves
+class FakeClockTimers : public Server::TimerManager {
+public:
+    uint64_t now = 1000;
+
+protected:
+    uint64_t getNowMS() override { return now; }
+};
+
+// jump the clock by getNextTimer() only, every timer has to fire exactly
+// at its deadline: the wheel may wake early but never late
+void test_wheel() {
+    FakeClockTimers timers;
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> delays;
+    for (int i = 0; i < 2000; ++i) {
+        int shift = rng() % 34;
+        delays.push_back(rng() % ((1ull << shift) + 1));
+    }
+    delays.push_back(1ull << 33);
+
+    std::vector<uint64_t> deadlines(delays.size());
+    std::vector<uint64_t> fired(delays.size(), 0);
+    std::vector<Server::Timer::ptr> handles;
+    for (size_t i = 0; i < delays.size(); ++i) {
+        // spread the start ticks so timers land on every level
+        timers.now += rng() % 3;
+        deadlines[i] = timers.now + delays[i];
+        handles.push_back(timers.addTimer(delays[i], [&, i]() { fired[i] = timers.now; }));
+    }
+
+    // timers already due fire on the first poll
+    uint64_t added = timers.now;
+
+    // cancelled timers never fire
+    size_t cancelled = 0;
+    for (size_t i = 0; i < handles.size(); i += 10) {
+        SERVER_ASSERT(handles[i]->cancel());
+        SERVER_ASSERT(!handles[i]->cancel());
+        ++cancelled;
+    }
+    SERVER_ASSERT(timers.getTimerCount() == handles.size() - cancelled);
+
+    size_t wakeups = 0;
+    std::vector<Server::Callable> cbs;
+    while (timers.hasTimer()) {
+        uint64_t next = timers.getNextTimer();
+        SERVER_ASSERT(next != ~0ull);
+        timers.now += next;
+        timers.listExpiredCb(cbs);
+        for (auto& cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+        ++wakeups;
+    }
+    SERVER_ASSERT(timers.getNextTimer() == ~0ull);
+
+    for (size_t i = 0; i < handles.size(); ++i) {
+        SERVER_ASSERT(fired[i] == (i % 10 ? std::max(deadlines[i], added) : 0));
+    }
+    SERVER_LOG_INFO(g_logger) << "wheel timers: " << handles.size() << " wakeups: " << wakeups;
+}
+
+void test_recurring() {
+    FakeClockTimers timers;
+    int count = 0;
+    Server::Timer::ptr t = timers.addTimer(10, [&]() { ++count; }, true);
+
+    std::vector<Server::Callable> cbs;
+    for (int i = 0; i < 100; ++i) {
+        ++timers.now;
+        timers.listExpiredCb(cbs);
+    }
+    for (auto& cb : cbs) {
+        cb();
+    }
+    SERVER_ASSERT(count == 10);
+
+    // refresh restarts the period, reset changes it
+    SERVER_ASSERT(t->refresh());
+    SERVER_ASSERT(timers.getNextTimer() == 10);
+    SERVER_ASSERT(t->reset(3, true));
+    SERVER_ASSERT(timers.getNextTimer() == 3);
+    SERVER_ASSERT(t->cancel());
+    SERVER_ASSERT(!t->refresh());
+    SERVER_ASSERT(!timers.hasTimer());
+}
+
+// timers on an IOManager wake epoll_wait at their deadline
+void test_iomanager() {
+    Server::IOManager iom(2, false, "timer");
+
+    std::atomic<uint64_t> firedAt{ 0 };
+    uint64_t start = Server::getCurrentMS();
+    iom.addTimer(50, [&]() { firedAt = Server::getCurrentMS(); });
+
+    std::atomic<int> ticks{ 0 };
+    Server::Timer::ptr recurring = iom.addTimer(10, [&]() { ++ticks; }, true);
+
+    // the condition is gone before the deadline, the callback is skipped
+    std::atomic<bool> condFired{ false };
+    {
+        std::shared_ptr<int> cond = std::make_shared<int>(0);
+        iom.addConditionTimer(20, [&]() { condFired = true; }, cond);
+    }
+
+    // moving a far deadline earlier wakes the poller
+    std::atomic<uint64_t> movedAt{ 0 };
+    Server::Timer::ptr moved = iom.addTimer(60 * 1000, [&]() { movedAt = Server::getCurrentMS(); });
+    SERVER_ASSERT(moved->reset(30, true));
+
+    usleep(200 * 1000);
+    SERVER_ASSERT(recurring->cancel());
+
+    SERVER_LOG_INFO(g_logger) << "iomanager timer after " << firedAt - start << "ms"
+                              << " moved after " << movedAt - start << "ms"
+                              << " recurring ticks: " << ticks;
+    SERVER_ASSERT(firedAt >= start + 50 && firedAt < start + 150);
+    SERVER_ASSERT(movedAt >= start + 30 && movedAt < start + 150);
+    SERVER_ASSERT(ticks >= 10 && ticks <= 21);
+    SERVER_ASSERT(!condFired);
+    SERVER_ASSERT(!iom.hasTimer());
+    iom.stop();
+}
+
+int main(int argc, char** argv) {
+    SERVER_LOG_NAME("system")->setLevel(Server::LogLevel::Level::ERROR);
+    test_wheel();
+    test_recurring();
+    test_iomanager();
+    return 0;
+}